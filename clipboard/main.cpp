@@ -71,8 +71,7 @@ int sblib_func_exec(int index, int argc, slib_par_t *params, var_t *retval) {
   if (index == 0 && argc == 0) {
     char *text = clipboard_text_ex(clipboard, NULL, LCB_CLIPBOARD);
     if (text != nullptr) {
-      v_setstr(retval, text);
-      free(text);
+      v_setstr_move(retval, text);
     }
     result = 1;
   } else {
@@ -15,6 +15,7 @@
 #include "include/var.h"
 #include "include/module.h"
 #include "include/param.h"
+#include "include/profile.h"
 
 char *programSource = nullptr;
 uint32_t modifiedTime;
@@ -66,11 +67,24 @@ static void bload_read(int bitSize, size_t size, FILE *file, var_t *retval) {
   }
 }
 
+//
+// reads the data as a packed block of bitSize elements without boxing each value
+//
+static void bload_read_packed(int bitSize, size_t size, FILE *file, var_t *retval) {
+  BufferType type = bitSize == 32 ? kBufferI32 : bitSize == 16 ? kBufferI16 : kBufferU8;
+  uint32_t elem_size = buffer_elem_size(type);
+  v_setbuffer(retval, nullptr, type, size);
+  size_t count = fread(retval->v.p.ptr, elem_size, size, file);
+  retval->v.p.length = (count * elem_size) + 1;
+  retval->v.p.ptr[count * elem_size] = '\0';
+}
+
 static int cmd_bload(int argc, slib_par_t *params, var_t *retval) {
   auto fileName = get_param_str(argc, params, 0, nullptr);
   auto offset = get_param_int(argc, params, 1, 0);
   auto length = get_param_int(argc, params, 2, 0);
   auto bitSize = get_param_int(argc, params, 3, 8);
+  auto packed = get_param_int(argc, params, 4, 0);
   char message[256] = {0};
 
   if (fileName != nullptr && offset >= 0 && length >= 0 && (bitSize == 8 || bitSize == 16 || bitSize == 32)) {
@@ -92,7 +106,11 @@ static int cmd_bload(int argc, slib_par_t *params, var_t *retval) {
             size -= offset;
           }
           fseek(file, offset, SEEK_SET);
-          bload_read(bitSize, size, file, retval);
+          if (packed) {
+            bload_read_packed(bitSize, size, file, retval);
+          } else {
+            bload_read(bitSize, size, file, retval);
+          }
         } else {
           // [0 | 1 | 2 | 3 | 4]
           //                   --^  --^
@@ -106,7 +124,7 @@ static int cmd_bload(int argc, slib_par_t *params, var_t *retval) {
       snprintf(message, sizeof(message), "BLOAD: [%s] Failed to open file", fileName);
     }
   } else {
-    snprintf(message, sizeof(message), "BLOAD: fileName [offset [length [bitSize 8|16|32]]]");
+    snprintf(message, sizeof(message), "BLOAD: fileName [offset [length [bitSize 8|16|32 [packed]]]]");
   }
   if (message[0] != '\0') {
     v_setstr(retval, message);
@@ -125,7 +143,7 @@ static int cmd_issourcemodified(int argc, slib_par_t *params, var_t *retval) {
 }
 
 FUNC_SIG lib_func[] = {
-  {1, 4, "BLOAD", cmd_bload},
+  {1, 5, "BLOAD", cmd_bload},
   {0, 0, "ISSOURCEMODIFIED", cmd_issourcemodified},
   {1, 20,"TEXTFORMAT", cmd_textformat},
 };
@@ -155,6 +173,8 @@ SBLIB_API int sblib_func_exec(int index, int argc, slib_par_t *params, var_t *re
         error(retval, lib_func[index]._name, lib_func[index]._min, lib_func[index]._max);
       }
       result = 0;
+    } else if (profiler().enabled()) {
+      result = profile_exec(true, index, lib_func[index], argc, params, retval);
     } else {
       result = lib_func[index]._command(argc, params, retval);
     }
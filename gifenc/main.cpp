@@ -12,20 +12,22 @@
 #include <math.h>
 
 #include "gifenc/gifenc.h"
-#include "robin-hood-hashing/src/include/robin_hood.h"
 #include "include/var.h"
 #include "include/module.h"
 #include "include/param.h"
+#include "include/profile.h"
+#include "include/handle.h"
 
-robin_hood::unordered_map<int, ge_GIF *> _gifMap;
-int _nextId = 1;
+#define CLS_GIF 1
+
+HandleTable<ge_GIF *> _gifMap(CLS_GIF);
 
 static int get_gif_id(int argc, slib_par_t *params, int arg, var_t *retval) {
   int result = -1;
   if (is_param_map(argc, params, arg)) {
     // the passed in variable is a map
     int id = get_id(params, arg);
-    if (id != -1 && _gifMap.find(id) != _gifMap.end()) {
+    if (id != -1 && _gifMap.contains(id)) {
       // the map contained an ID field with a live value
       result = id;
     }
@@ -36,23 +38,8 @@ static int get_gif_id(int argc, slib_par_t *params, int arg, var_t *retval) {
   return result;
 }
 
-static uint8_t *get_param_byte_p(int argc, slib_par_t *params, int n) {
-  uint8_t *result = nullptr;
-  if (is_param_array(argc, params, n)) {
-    int size = v_asize(params[n].var_p);
-    if (size) {
-      result = new uint8_t[size + 1];
-      for (int i = 0; i < size; i++) {
-        result[i] = get_array_elem_num(params[n].var_p, i);
-      }
-    }
-  }
-  return result;
-}
-
 static void v_setgif(var_t *var, ge_GIF *gif) {
-  auto id = ++_nextId;
-  _gifMap[id] = gif;
+  auto id = _gifMap.add(gif);
   map_init_id(var, id);
   v_setint(map_add_var(var, "w", 0), gif->w);
   v_setint(map_add_var(var, "h", 0), gif->h);
@@ -66,14 +53,15 @@ static int cmd_new_gif(int argc, slib_par_t *params, var_t *retval) {
   auto fname = get_param_str(argc, params, 0, 0);
   auto width = get_param_int(argc, params, 1, 0);
   auto height = get_param_int(argc, params, 2, 0);
-  auto palette = get_param_byte_p(argc, params, 3);
+  TypedBuffer palette;
+  get_param_buffer(argc, params, 3, kBufferU8, &palette);
   auto bgindex = get_param_int(argc, params, 4, 0);
   auto loop = get_param_int(argc, params, 5, 0);
 
   int depth = 8;
   int result = 1;
-  if (palette) {
-    int size = v_asize(params[3].var_p);
+  if (palette._length) {
+    int size = palette._length;
     if (size % 3 != 0) {
       error(retval, "Invalid pallete");
       result = 0;
@@ -83,14 +71,14 @@ static int cmd_new_gif(int argc, slib_par_t *params, var_t *retval) {
   }
 
   if (result) {
-    auto fnResult = ge_new_gif(fname, width, height, palette, depth, bgindex, loop);
+    auto fnResult = ge_new_gif(fname, width, height, (uint8_t *)palette._data, depth, bgindex, loop);
     if (fnResult != nullptr) {
       v_setgif(retval, fnResult);
     } else {
       result = 0;
     }
   }
-  delete [] palette;
+  buffer_free(&palette);
   return result;
 }
 
@@ -98,21 +86,23 @@ static int cmd_add_frame(int argc, slib_par_t *params, var_t *retval) {
   int result = 0;
   int id = get_gif_id(argc, params, 0, retval);
   if (id != -1) {
-    ge_GIF *gif = _gifMap[id];
-    auto pixels = get_param_byte_p(argc, params, 2);
-    if (pixels) {
+    ge_GIF *gif = _gifMap.at(id);
+    TypedBuffer pixels;
+    get_param_buffer(argc, params, 2, kBufferU8, &pixels);
+    if (pixels._length) {
       int maxFrame = gif->w * gif->h;
-      int size = v_asize(params[2].var_p) - 1;
+      // arrays are dimensioned with an extra trailing element, strings are exact
+      int size = is_param_array(argc, params, 2) ? pixels._length - 1 : pixels._length;
       if (size > maxFrame) {
         error(retval, "Pixel array too large");
       } else {
-        memcpy(gif->frame, pixels, size);
+        memcpy(gif->frame, pixels._data, size);
         auto delay = get_param_int(argc, params, 1, 0);
         ge_add_frame(gif, delay);
         v_setint(retval, 1);
         result = 1;
       }
-      delete [] pixels;
+      buffer_free(&pixels);
     } else {
       error(retval, "Pixel array empty");
     }
@@ -124,7 +114,9 @@ static int cmd_close_gif(int argc, slib_par_t *params, var_t *retval) {
   int result;
   int id = get_gif_id(argc, params, 0, retval);
   if (id != -1) {
-    ge_close_gif(_gifMap[id]);
+    ge_close_gif(_gifMap.at(id));
+    // invalidate the handle so that further calls report "GIF not found"
+    _gifMap.erase(id);
     v_setint(retval, 1);
     result = 1;
   } else {
@@ -182,6 +174,8 @@ SBLIB_API int sblib_proc_exec(int index, int argc, slib_par_t *params, var_t *re
         error(retval, lib_proc[index]._name, lib_proc[index]._min, lib_proc[index]._max);
       }
       result = 0;
+    } else if (profiler().enabled()) {
+      result = profile_exec(false, index, lib_proc[index], argc, params, retval);
     } else {
       result = lib_proc[index]._command(argc, params, retval);
     }
@@ -202,6 +196,8 @@ SBLIB_API int sblib_func_exec(int index, int argc, slib_par_t *params, var_t *re
         error(retval, lib_func[index]._name, lib_func[index]._min, lib_func[index]._max);
       }
       result = 0;
+    } else if (profiler().enabled()) {
+      result = profile_exec(true, index, lib_func[index], argc, params, retval);
     } else {
       result = lib_func[index]._command(argc, params, retval);
     }
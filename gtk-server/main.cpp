@@ -18,15 +18,23 @@
 
 extern "C" char *gtk(char *arg);
 
-#define MAX_TEXT_BUFFER_LENGTH 1024
-
 int debug = 0;
 
-static char buffer[MAX_TEXT_BUFFER_LENGTH];
 static const char *formatError = "ERROR: Invalid text format:";
 
+//
+// gtk() takes a mutable string, copy the formatted command into a scratch buffer
+//
+static char *format_command(int argc, slib_par_t *params) {
+  const char *text = format_text(argc, params, 0);
+  size_t length = strlen(text) + 1;
+  char *result = scratch_buffer(length);
+  memcpy(result, text, length);
+  return result;
+}
+
 static int cmd_gtk(int argc, slib_par_t *params, var_t *retval) {
-  strcpy(buffer, format_text(argc, params, 0));
+  char *buffer = format_command(argc, params);
   char *result = gtk(buffer);
   v_setstrn(retval, result, strlen(result) - 1);
   if (debug) {
@@ -39,7 +47,7 @@ static int cmd_gtk(int argc, slib_par_t *params, var_t *retval) {
 }
 
 static int cmd_gtk_proc(int argc, slib_par_t *params, var_t *retval) {
-  strcpy(buffer, format_text(argc, params, 0));
+  char *buffer = format_command(argc, params);
   gtk(buffer);
   if (debug) {
     fprintf(stdout, "DEBUG: PROC IN [%s]\n", buffer);
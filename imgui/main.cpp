@@ -28,11 +28,16 @@ ImVec4 clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
 
 using namespace ImGui;
 
+static const MapKey KEY_X = map_key("x");
+static const MapKey KEY_Y = map_key("y");
+static const MapKey KEY_Z = map_key("z");
+static const MapKey KEY_W = map_key("w");
+
 static ImVec2 get_param_vec2(int argc, slib_par_t *params, int n) {
   ImVec2 result;
   if (is_param_map(argc, params, n)) {
-    result.x = get_map_num(params[n].var_p, "x");
-    result.y = get_map_num(params[n].var_p, "y");
+    result.x = get_map_num_h(params[n].var_p, KEY_X);
+    result.y = get_map_num_h(params[n].var_p, KEY_Y);
   } else if (is_param_array(argc, params, n)) {
     result.x = get_array_elem_num(params[n].var_p, 0);
     result.y = get_array_elem_num(params[n].var_p, 1);
@@ -46,10 +51,10 @@ static ImVec2 get_param_vec2(int argc, slib_par_t *params, int n) {
 static ImVec4 get_param_vec4(int argc, slib_par_t *params, int n) {
   ImVec4 result;
   if (is_param_map(argc, params, n)) {
-    result.x = get_map_num(params[n].var_p, "x");
-    result.y = get_map_num(params[n].var_p, "y");
-    result.z = get_map_num(params[n].var_p, "z");
-    result.w = get_map_num(params[n].var_p, "w");
+    result.x = get_map_num_h(params[n].var_p, KEY_X);
+    result.y = get_map_num_h(params[n].var_p, KEY_Y);
+    result.z = get_map_num_h(params[n].var_p, KEY_Z);
+    result.w = get_map_num_h(params[n].var_p, KEY_W);
   } else if (is_param_array(argc, params, n)) {
     result.x = get_array_elem_num(params[n].var_p, 0);
     result.y = get_array_elem_num(params[n].var_p, 1);
@@ -66,8 +71,8 @@ static ImVec4 get_param_vec4(int argc, slib_par_t *params, int n) {
 
 static void v_set_vec2(var_t *var, ImVec2 &vec2) {
   map_init(var);
-  v_setint(map_add_var(var, "x", 0), vec2.x);
-  v_setint(map_add_var(var, "y", 0), vec2.y);
+  v_setint(map_add_var_h(var, KEY_X, 0), vec2.x);
+  v_setint(map_add_var_h(var, KEY_Y, 0), vec2.y);
 }
 
 static GLFWwindow *get_window(int argc, slib_par_t *params) {
@@ -9,11 +9,90 @@
 
 #include <cstring>
 #include <cstdio>
+#include <cstdlib>
+#include <ctype.h>
 #include "param.h"
+#include "profile.h"
 
 extern FUNC_SIG lib_func[];
 extern FUNC_SIG lib_proc[];
 
+#if defined(__GNUC__)
+ #define API_UNLIKELY(x) __builtin_expect(!!(x), 0)
+ #define API_COLD __attribute__((noinline, cold))
+#else
+ #define API_UNLIKELY(x) (x)
+ #define API_COLD
+#endif
+
+//
+// name to index lookup table, built on first use. open addressing with
+// linear probing over a power of two sized slot array holding index + 1
+//
+struct LookupTable {
+  int *_slots;
+  uint32_t _mask;
+};
+
+static LookupTable proc_lookup = {nullptr, 0};
+static LookupTable func_lookup = {nullptr, 0};
+
+static uint32_t name_hash(const char *name) {
+  // FNV-1a over the upper-cased name
+  uint32_t hash = 2166136261u;
+  for (const char *p = name; *p != '\0'; p++) {
+    hash ^= (uint8_t)toupper((uint8_t)*p);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static void lookup_build(LookupTable &table, const FUNC_SIG *sigs, int count) {
+  uint32_t size = 16;
+  while (size < (uint32_t)count * 2) {
+    size <<= 1;
+  }
+  table._mask = size - 1;
+  table._slots = (int *)calloc(size, sizeof(int));
+  for (int i = 0; i < count; i++) {
+    uint32_t slot = name_hash(sigs[i]._name) & table._mask;
+    while (table._slots[slot] != 0) {
+      slot = (slot + 1) & table._mask;
+    }
+    table._slots[slot] = i + 1;
+  }
+}
+
+static int lookup_find(LookupTable &table, const FUNC_SIG *sigs, int count, const char *name) {
+  if (table._slots == nullptr) {
+    lookup_build(table, sigs, count);
+  }
+  int result = -1;
+  uint32_t slot = name_hash(name) & table._mask;
+  while (table._slots[slot] != 0) {
+    int index = table._slots[slot] - 1;
+    if (strcasecmp(sigs[index]._name, name) == 0) {
+      result = index;
+      break;
+    }
+    slot = (slot + 1) & table._mask;
+  }
+  return result;
+}
+
+static int check_arity(const FUNC_SIG &sig, int argc) {
+  return (argc >= sig._min && argc <= sig._max);
+}
+
+static API_COLD int arity_error(const FUNC_SIG &sig, var_t *retval) {
+  if (sig._min == sig._max) {
+    error(retval, sig._name, sig._min);
+  } else {
+    error(retval, sig._name, sig._min, sig._max);
+  }
+  return 0;
+}
+
 SBLIB_API int sblib_proc_getname(int index, char *proc_name) {
   int result;
   if (index < sblib_proc_count()) {
@@ -36,42 +115,67 @@ SBLIB_API int sblib_func_getname(int index, char *proc_name) {
   return result;
 }
 
+SBLIB_API int sblib_proc_lookup(const char *name, int argc) {
+  int result = lookup_find(proc_lookup, lib_proc, sblib_proc_count(), name);
+  if (result != -1 && argc != -1 && !check_arity(lib_proc[result], argc)) {
+    result = -2;
+  }
+  return result;
+}
+
+SBLIB_API int sblib_func_lookup(const char *name, int argc) {
+  int result = lookup_find(func_lookup, lib_func, sblib_func_count(), name);
+  if (result != -1 && argc != -1 && !check_arity(lib_func[result], argc)) {
+    result = -2;
+  }
+  return result;
+}
+
 SBLIB_API int sblib_proc_exec(int index, int argc, slib_par_t *params, var_t *retval) {
   int result;
-  if (index >= 0 && index < sblib_proc_count()) {
-    if (argc < lib_proc[index]._min || argc > lib_proc[index]._max) {
-      if (lib_proc[index]._min == lib_proc[index]._max) {
-        error(retval, lib_proc[index]._name, lib_proc[index]._min);
-      } else {
-        error(retval, lib_proc[index]._name, lib_proc[index]._min, lib_proc[index]._max);
-      }
-      result = 0;
-    } else {
-      result = lib_proc[index]._command(argc, params, retval);
-    }
-  } else {
+  if (API_UNLIKELY(index < 0 || index >= sblib_proc_count())) {
     fprintf(stderr, "PROC index error [%d]\n", index);
     result = 0;
+  } else if (API_UNLIKELY(!check_arity(lib_proc[index], argc))) {
+    result = arity_error(lib_proc[index], retval);
+  } else if (API_UNLIKELY(profiler().enabled())) {
+    result = profile_exec(false, index, lib_proc[index], argc, params, retval);
+  } else {
+    result = lib_proc[index]._command(argc, params, retval);
   }
   return result;
 }
 
 SBLIB_API int sblib_func_exec(int index, int argc, slib_par_t *params, var_t *retval) {
   int result;
-  if (index >= 0 && index < sblib_func_count()) {
-    if (argc < lib_func[index]._min || argc > lib_func[index]._max) {
-      if (lib_func[index]._min == lib_func[index]._max) {
-        error(retval, lib_func[index]._name, lib_func[index]._min);
-      } else {
-        error(retval, lib_func[index]._name, lib_func[index]._min, lib_func[index]._max);
-      }
-      result = 0;
-    } else {
-      result = lib_func[index]._command(argc, params, retval);
-    }
-  } else {
+  if (API_UNLIKELY(index < 0 || index >= sblib_func_count())) {
     fprintf(stderr, "FUNC index error [%d]\n", index);
     result = 0;
+  } else if (API_UNLIKELY(!check_arity(lib_func[index], argc))) {
+    result = arity_error(lib_func[index], retval);
+  } else if (API_UNLIKELY(profiler().enabled())) {
+    result = profile_exec(true, index, lib_func[index], argc, params, retval);
+  } else {
+    result = lib_func[index]._command(argc, params, retval);
+  }
+  return result;
+}
+
+SBLIB_API int sblib_exec_batch(int count, slib_call_t *calls, var_t *retvals) {
+  int result = 0;
+  for (int i = 0; i < count; i++) {
+    // a separate retval per call, since a map result cannot be reused or freed here
+    const slib_call_t &call = calls[i];
+    int success;
+    if (call.is_func) {
+      success = sblib_func_exec(call.index, call.param_count, call.params, &retvals[i]);
+    } else {
+      success = sblib_proc_exec(call.index, call.param_count, call.params, &retvals[i]);
+    }
+    if (!success) {
+      break;
+    }
+    result++;
   }
   return result;
 }
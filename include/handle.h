@@ -0,0 +1,263 @@
+// This file is part of SmallBASIC
+//
+// Generational handle tables for module resources
+//
+// A handle packs a slot index, the slot generation and a type tag into the
+// int stored in the var_t map id field:
+//
+//   bits  0..17  slot index
+//   bits 18..26  generation, bumped whenever the slot is released or refreshed
+//   bits 27..30  tag, normally the cls_id passed to map_init_id
+//
+// Lookups are a bounds check plus a compare against the slot generation, so a
+// handle held by a BASIC variable after the resource was freed is detected as
+// stale rather than aliasing whatever later reused the slot.
+//
+// This program is distributed under the terms of the GPL v2.0 or later
+// Download the GNU Public License (GPL) from www.gnu.org
+//
+// Copyright(C) 2026 Chris Warren-Smith
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#define HANDLE_INDEX_BITS 18
+#define HANDLE_GEN_BITS 9
+#define HANDLE_TAG_BITS 4
+#define HANDLE_TAGS (1 << HANDLE_TAG_BITS)
+#define HANDLE_INDEX_MASK ((1 << HANDLE_INDEX_BITS) - 1)
+#define HANDLE_GEN_MASK ((1 << HANDLE_GEN_BITS) - 1)
+#define HANDLE_TAG_MASK (HANDLE_TAGS - 1)
+
+inline int handle_make(int tag, uint32_t generation, uint32_t index) {
+  return (int)(((uint32_t)tag << (HANDLE_INDEX_BITS + HANDLE_GEN_BITS)) |
+               (generation << HANDLE_INDEX_BITS) | index);
+}
+
+inline int handle_tag(int handle) {
+  return (handle >> (HANDLE_INDEX_BITS + HANDLE_GEN_BITS)) & HANDLE_TAG_MASK;
+}
+
+inline uint32_t handle_generation(int handle) {
+  return ((uint32_t)handle >> HANDLE_INDEX_BITS) & HANDLE_GEN_MASK;
+}
+
+inline uint32_t handle_index(int handle) {
+  return (uint32_t)handle & HANDLE_INDEX_MASK;
+}
+
+//
+// type independent interface used by the sblib_free/sblib_refresh_id dispatchers
+//
+struct HandleTableBase {
+  virtual ~HandleTableBase() {}
+  virtual bool release(int handle) = 0;
+  virtual int refresh(int handle) = 0;
+};
+
+//
+// returns the table registered for the given tag within this module
+//
+inline HandleTableBase *&handle_table(int tag) {
+  static HandleTableBase *tables[HANDLE_TAGS] = {};
+  return tables[tag & HANDLE_TAG_MASK];
+}
+
+template<typename T>
+struct HandleTable : public HandleTableBase {
+  typedef void (*Release)(T &value);
+
+  //
+  // the optional release function is invoked when sblib_free discards the value
+  //
+  explicit HandleTable(int tag, Release release = nullptr) :
+    _tag(tag & HANDLE_TAG_MASK),
+    _release(release),
+    _freeList(-1),
+    _count(0) {
+    handle_table(_tag) = this;
+  }
+
+  ~HandleTable() override {
+    if (handle_table(_tag) == this) {
+      handle_table(_tag) = nullptr;
+    }
+  }
+
+  HandleTable(const HandleTable &) = delete;
+  HandleTable &operator=(const HandleTable &) = delete;
+
+  //
+  // stores the value and returns its handle, or -1 when all slots are in use
+  //
+  int add(T value) {
+    uint32_t index;
+    if (_freeList != -1) {
+      index = _freeList;
+      _freeList = _slots[index]._nextFree;
+    } else if (_slots.size() <= HANDLE_INDEX_MASK) {
+      index = _slots.size();
+      _slots.emplace_back();
+    } else {
+      return -1;
+    }
+    Slot &slot = _slots[index];
+    slot._value = std::move(value);
+    slot._live = true;
+    _count++;
+    return handle_make(_tag, slot._generation, index);
+  }
+
+  //
+  // returns the live value for the handle, nullptr when the handle is stale
+  //
+  T *get(int handle) {
+    Slot *slot = find(handle);
+    return slot != nullptr ? &slot->_value : nullptr;
+  }
+
+  bool contains(int handle) const {
+    uint32_t index = handle_index(handle);
+    return (handle >= 0 &&
+            handle_tag(handle) == _tag &&
+            index < _slots.size() &&
+            _slots[index]._live &&
+            _slots[index]._generation == handle_generation(handle));
+  }
+
+  //
+  // unchecked access for handles already validated with contains() or get()
+  //
+  T &at(int handle) {
+    return _slots[handle_index(handle)]._value;
+  }
+
+  //
+  // discards the value without calling the release function
+  //
+  bool erase(int handle) {
+    bool result;
+    Slot *slot = find(handle);
+    if (slot != nullptr) {
+      slot->_value = T();
+      slot->_live = false;
+      slot->_generation = next_generation(slot->_generation);
+      slot->_nextFree = _freeList;
+      _freeList = handle_index(handle);
+      _count--;
+      result = true;
+    } else {
+      result = false;
+    }
+    return result;
+  }
+
+  //
+  // calls the release function then discards the value
+  //
+  bool release(int handle) override {
+    bool result;
+    Slot *slot = find(handle);
+    if (slot != nullptr) {
+      if (_release != nullptr) {
+        _release(slot->_value);
+      }
+      result = erase(handle);
+    } else {
+      result = false;
+    }
+    return result;
+  }
+
+  //
+  // invalidates the handle and returns a fresh handle for the same value
+  //
+  int refresh(int handle) override {
+    int result;
+    Slot *slot = find(handle);
+    if (slot != nullptr) {
+      slot->_generation = next_generation(slot->_generation);
+      result = handle_make(_tag, slot->_generation, handle_index(handle));
+    } else {
+      result = handle;
+    }
+    return result;
+  }
+
+  //
+  // visits each live value, used when closing the module
+  //
+  template<typename F>
+  void for_each(F fn) {
+    for (Slot &slot : _slots) {
+      if (slot._live) {
+        fn(slot._value);
+      }
+    }
+  }
+
+  void clear() {
+    _slots.clear();
+    _freeList = -1;
+    _count = 0;
+  }
+
+  bool empty() const { return _count == 0; }
+  size_t size() const { return _count; }
+
+  private:
+  struct Slot {
+    Slot() : _value(), _generation(1), _nextFree(-1), _live(false) {}
+    T _value;
+    uint32_t _generation;
+    int _nextFree;
+    bool _live;
+  };
+
+  static uint32_t next_generation(uint32_t generation) {
+    // generation zero is skipped so that a handle is never zero
+    uint32_t result = (generation + 1) & HANDLE_GEN_MASK;
+    return result == 0 ? 1 : result;
+  }
+
+  Slot *find(int handle) {
+    return contains(handle) ? &_slots[handle_index(handle)] : nullptr;
+  }
+
+  int _tag;
+  Release _release;
+  int _freeList;
+  size_t _count;
+  std::vector<Slot> _slots;
+};
+
+//
+// sblib_free implementation for modules keeping all resources in handle tables
+//
+inline int handle_free(int cls_id, int handle) {
+  if (handle != -1 && cls_id >= 0 && cls_id < HANDLE_TAGS) {
+    HandleTableBase *table = handle_table(cls_id);
+    if (table != nullptr) {
+      table->release(handle);
+    }
+  }
+  return 0;
+}
+
+//
+// sblib_refresh_id implementation for modules keeping all resources in handle tables
+//
+inline int handle_refresh(int cls_id, int handle) {
+  int result = handle;
+  if (handle != -1 && cls_id >= 0 && cls_id < HANDLE_TAGS) {
+    HandleTableBase *table = handle_table(cls_id);
+    if (table != nullptr) {
+      result = table->refresh(handle);
+    }
+  }
+  return result;
+}
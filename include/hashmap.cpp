@@ -20,6 +20,13 @@
 
 #define MAP_SIZE 32
 
+//
+// Note: maps created here are returned to, and later destroyed by, the
+// SmallBASIC host which walks v.m.map using its own copy of this code.
+// The bucket array, Node layout, hash function and key ordering must
+// therefore remain identical to src/common/hashmap.cpp in SmallBASIC.
+//
+
 /**
  * Our internal tree element node
  */
@@ -41,37 +48,40 @@ Node *tree_create_node(var_p_t key) {
   return node;
 }
 
+/**
+ * Case folding without the tolower() call for plain ASCII. Has no static
+ * state so it may be used from other static initialisers (see map_key)
+ */
+static inline char fold(char c) {
+  unsigned char uc = (unsigned char)c;
+  return (char)(uc < 0x80 ? (uc >= 'A' && uc <= 'Z' ? uc + ('a' - 'A') : uc) : tolower(uc));
+}
+
 int str_compare(const char *s1, int s1n, const char *s2, int s2n) {
-  int result = 0;
-  for (int i = 0;; i++) {
-    if (i == s1n || i == s2n) {
-      result = s1n < s2n ? -1 : s1n > s2n ? 1 : 0;
-      break;
-    }
+  int n = s1n < s2n ? s1n : s2n;
+  for (int i = 0; i < n; i++) {
     char c1 = s1[i];
     char c2 = s2[i];
     if (c1 != c2) {
-      c1 = tolower(c1);
-      c2 = tolower(c2);
+      c1 = fold(c1);
+      c2 = fold(c2);
       if (c1 != c2) {
-        result = c1 < c2 ? -1 : 1;
-        break;
+        return c1 < c2 ? -1 : 1;
       }
     }
   }
-  return result;
+  return s1n < s2n ? -1 : s1n > s2n ? 1 : 0;
 }
 
-static inline int tree_compare(const char *key, int length, var_p_t vkey) {
-  int len1 = length;
-  if (len1 && key[len1 - 1] == '\0') {
-    len1--;
-  }
-  int len2 = vkey->v.p.length;
-  if (len2 && vkey->v.p.ptr[len2 - 1] == '\0') {
-    len2--;
+static inline int key_length(const char *key, int length) {
+  if (length && key[length - 1] == '\0') {
+    length--;
   }
-  return str_compare(key, len1, vkey->v.p.ptr, len2);
+  return length;
+}
+
+static inline int tree_compare(const char *key, int length, var_p_t vkey) {
+  return str_compare(key, length, vkey->v.p.ptr, key_length(vkey->v.p.ptr, vkey->v.p.length));
 }
 
 Node *tree_search(Node **rootp, const char *key, int length) {
@@ -101,15 +111,15 @@ Node *tree_find(Node **rootp, const char *key, int length) {
 int hashmap_get_hash(const char *key, int length) {
   int hash = 1, i;
   for (i = 0; i < length && key[i] != '\0'; i++) {
-    hash += tolower(key[i]);
+    hash += fold(key[i]);
     hash <<= 3;
     hash ^= (hash >> 3);
   }
   return hash;
 }
 
-static inline Node *hashmap_search(var_p_t map, const char *key, int length) {
-  int index = hashmap_get_hash(key, length) % map->v.m.size;
+static inline Node *hashmap_search(var_p_t map, const char *key, int length, int hash) {
+  int index = hash % map->v.m.size;
   Node **table = (Node **)map->v.m.map;
   Node *result = table[index];
   if (result == nullptr) {
@@ -126,9 +136,8 @@ static inline Node *hashmap_search(var_p_t map, const char *key, int length) {
   return result;
 }
 
-static inline Node *hashmap_find(var_p_t map, const char *key) {
-  int length = strlen(key);
-  int index = hashmap_get_hash(key, length) % map->v.m.size;
+static inline Node *hashmap_find(var_p_t map, const char *key, int length, int hash) {
+  int index = hash % map->v.m.size;
   Node **table = (Node **)map->v.m.map;
   Node *result = table[index];
   if (result != nullptr) {
@@ -160,7 +169,14 @@ void hashmap_create(var_p_t map, int size) {
 
 var_p_t hashmap_putv(var_p_t map, const var_p_t key) {
   assert(key->type == V_STR);
-  Node *node = hashmap_search(map, key->v.p.ptr, key->v.p.length);
+  int length = key_length(key->v.p.ptr, key->v.p.length);
+  return hashmap_putv_h(map, key, hashmap_get_hash(key->v.p.ptr, length));
+}
+
+var_p_t hashmap_putv_h(var_p_t map, const var_p_t key, int hash) {
+  assert(key->type == V_STR);
+  int length = key_length(key->v.p.ptr, key->v.p.length);
+  Node *node = hashmap_search(map, key->v.p.ptr, length, hash);
   assert(node->key == nullptr);
   node->key = key;
   node->value = v_new();
@@ -169,13 +185,11 @@ var_p_t hashmap_putv(var_p_t map, const var_p_t key) {
 }
 
 var_p_t hashmap_get(var_p_t map, const char *key) {
-  var_p_t result;
-  Node *node = hashmap_find(map, key);
-  if (node != nullptr) {
-    result = node->value;
-  } else {
-    result = nullptr;
-  }
-  return result;
+  int length = strlen(key);
+  return hashmap_get_h(map, key, length, hashmap_get_hash(key, length));
 }
 
+var_p_t hashmap_get_h(var_p_t map, const char *key, int length, int hash) {
+  Node *node = hashmap_find(map, key, length, hash);
+  return node != nullptr ? node->value : nullptr;
+}
@@ -15,6 +15,11 @@
 void hashmap_create(var_p_t map, int size);
 var_p_t hashmap_putv(var_p_t map, const var_p_t key);
 var_p_t hashmap_get(var_p_t map, const char *key);
+int hashmap_get_hash(const char *key, int length);
+
+// variants accepting a hash previously obtained from hashmap_get_hash()
+var_p_t hashmap_putv_h(var_p_t map, const var_p_t key, int hash);
+var_p_t hashmap_get_h(var_p_t map, const char *key, int length, int hash);
 
 #endif /* !_HASHMAP_H_ */
 
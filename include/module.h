@@ -117,6 +117,64 @@ int sblib_func_getname(int index, char *func_name);
  */
 int sblib_func_exec(int index, int param_count, slib_par_t *params, var_t *retval);
 
+/**
+ * @ingroup modlib
+ *
+ * resolves a procedure name to its index. optional entry point, when
+ * present the module manager may use this in place of scanning
+ * sblib_proc_getname. the argument count is validated here so that
+ * mismatches are reported when the program is loaded.
+ *
+ * @param name the procedure name (case insensitive)
+ * @param param_count the number of parameters at the call site, or -1 to skip validation
+ * @return the index, -1 when not found, or -2 when param_count is not accepted
+ */
+int sblib_proc_lookup(const char *name, int param_count);
+
+/**
+ * @ingroup modlib
+ *
+ * resolves a function name to its index. see sblib_proc_lookup
+ *
+ * @param name the function name (case insensitive)
+ * @param param_count the number of parameters at the call site, or -1 to skip validation
+ * @return the index, -1 when not found, or -2 when param_count is not accepted
+ */
+int sblib_func_lookup(const char *name, int param_count);
+
+/**
+ * @ingroup modlib
+ *
+ * a single call record for sblib_exec_batch
+ */
+typedef struct {
+  // the procedure or function index
+  int index;
+
+  // non-zero to invoke the function table, otherwise the procedure table
+  int is_func;
+
+  // the number of the parameters
+  int param_count;
+
+  // the parameters table
+  slib_par_t *params;
+} slib_call_t;
+
+/**
+ * @ingroup modlib
+ *
+ * executes a sequence of procedures and functions in a single call.
+ * each call sets its own element of retvals, execution stops at the
+ * first failure leaving the error message in that call's element.
+ *
+ * @param count the number of calls
+ * @param calls the call records
+ * @param retvals count var_t objects, initialised by the caller, to set the return values
+ * @return the number of calls successfully executed
+ */
+int sblib_exec_batch(int count, slib_call_t *calls, var_t *retvals);
+
 /**
  * @ingroup modlib
  *
@@ -6,17 +6,88 @@
 // Copyright(C) 2020 Chris Warren-Smith
 
 #include <cstring>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cassert>
 #include <ctype.h>
+#include <string>
+#if defined(__GLIBC__) || defined(__ANDROID__)
+ #include <malloc.h>
+#elif defined(__APPLE__)
+ #include <malloc/malloc.h>
+#endif
 
 #include "config.h"
 #include "param.h"
 #include "hashmap.h"
 #include "var.h"
 
-#define MAX_TEXT_BUFFER_LENGTH 1024
+#define SCRATCH_SLOTS 4
+#define SCRATCH_MIN_SIZE 64
+
+// room for any "%lld" or "%f" value, the largest double printing as 309 digits plus fraction
+#define SCRATCH_NUMBER_SIZE 320
+
+//
+// per-thread rotating set of growable buffers
+//
+struct Scratch {
+  char *_data[SCRATCH_SLOTS];
+  size_t _size[SCRATCH_SLOTS];
+  int _next;
+
+  Scratch() : _next(0) {
+    for (int i = 0; i < SCRATCH_SLOTS; i++) {
+      _data[i] = nullptr;
+      _size[i] = 0;
+    }
+  }
+
+  ~Scratch() {
+    for (int i = 0; i < SCRATCH_SLOTS; i++) {
+      free(_data[i]);
+    }
+  }
+};
+
+static thread_local Scratch scratch;
+
+char *scratch_buffer(size_t size) {
+  int slot = scratch._next;
+  scratch._next = (slot + 1) % SCRATCH_SLOTS;
+  if (scratch._size[slot] < size) {
+    size_t capacity = scratch._size[slot] * 2;
+    if (capacity < size) {
+      capacity = size;
+    }
+    if (capacity < SCRATCH_MIN_SIZE) {
+      capacity = SCRATCH_MIN_SIZE;
+    }
+    free(scratch._data[slot]);
+    scratch._data[slot] = (char *)malloc(capacity);
+    scratch._size[slot] = capacity;
+  }
+  return scratch._data[slot];
+}
+
+template<typename T>
+static int append_format(std::string &out, const char *format, T value) {
+  int count = snprintf(nullptr, 0, format, value);
+  if (count > 0) {
+    size_t pos = out.size();
+    out.resize(pos + count + 1);
+    snprintf(&out[pos], count + 1, format, value);
+    out.resize(pos + count);
+  }
+  return count;
+}
+
+static const char *scratch_copy(const std::string &text) {
+  char *result = scratch_buffer(text.size() + 1);
+  memcpy(result, text.c_str(), text.size() + 1);
+  return result;
+}
 
 void error(var_p_t var, const char *field, int nMin, int nMax) {
   char message[256];
@@ -173,29 +244,53 @@ void v_setreal(var_t *var, var_num_t n) {
 }
 
 void v_setstr(var_t *var, const char *str) {
-  int length = strlen(str == nullptr ? 0 : str);
-  v_setstrn(var, str, length);
+  if (str == nullptr) {
+    str = "";
+  }
+  v_setstrn(var, str, strlen(str));
+}
+
+//
+// bytes available in an owned string buffer. var_t has no room for a capacity, so the
+// allocator is asked where it can tell, otherwise only the current length is known
+//
+static size_t str_capacity(const var_t *var) {
+  size_t result;
+#if defined(__GLIBC__) || defined(__ANDROID__)
+  result = malloc_usable_size(var->v.p.ptr);
+#elif defined(__APPLE__)
+  result = malloc_size(var->v.p.ptr);
+#else
+  result = 0;
+#endif
+  return result > var->v.p.length ? result : var->v.p.length;
 }
 
 void v_setstrn(var_t *var, const char *str, int length) {
   assert(var->type != V_ARRAY && var->type != V_MAP);
 
-  bool isSet = false;
-  if (var->type == V_STR) {
-    if (strcmp(str, var->v.p.ptr) == 0) {
-      // already set
-      isSet = true;
-    } else if (var->v.p.owner) {
-      free(var->v.p.ptr);
-    }
-  }
-  if (!isSet) {
+  if (var->type == V_STR && var->v.p.owner && str_capacity(var) > (size_t)length) {
+    // the existing buffer is large enough. str may overlap it.
+    memmove(var->v.p.ptr, str, length);
+  } else {
+    char *ptr = (char *)malloc(length + 1);
+    memcpy(ptr, str, length);
+    v_free(var);
     var->type = V_STR;
-    var->v.p.ptr = (char *)calloc(length + 1, 1);
-    var->v.p.length = length + 1;
+    var->v.p.ptr = ptr;
     var->v.p.owner = 1;
-    strncpy(var->v.p.ptr, str, length);
   }
+  var->v.p.ptr[length] = '\0';
+  var->v.p.length = length + 1;
+}
+
+void v_setstr_move(var_t *var, char *str) {
+  assert(var->type != V_ARRAY && var->type != V_MAP);
+  v_free(var);
+  var->type = V_STR;
+  var->v.p.ptr = str;
+  var->v.p.length = strlen(str) + 1;
+  var->v.p.owner = 1;
 }
 
 int v_strlen(const var_t *v) {
@@ -250,12 +345,50 @@ var_p_t map_get(var_p_t base, const char *name) {
   return result;
 }
 
+MapKey map_key(const char *name) {
+  MapKey result;
+  result._name = name;
+  result._length = strlen(name);
+  result._hash = hashmap_get_hash(name, result._length);
+  return result;
+}
+
+var_p_t map_add_var_h(var_p_t base, const MapKey &key, int value) {
+  // the interned name outlives the map, so the key can reference it
+  // directly rather than allocating a copy. the host does not free
+  // strings without the owner flag.
+  var_p_t v_key = v_new();
+  v_key->type = V_STR;
+  v_key->v.p.ptr = (char *)key._name;
+  v_key->v.p.length = key._length + 1;
+  v_key->v.p.owner = 0;
+  var_p_t var = hashmap_putv_h(base, v_key, key._hash);
+  v_setint(var, value);
+  return var;
+}
+
+var_p_t map_get_h(var_p_t base, const MapKey &key) {
+  var_p_t result;
+  if (base != nullptr && base->type == V_MAP) {
+    result = hashmap_get_h(base, key._name, key._length, key._hash);
+  } else {
+    result = nullptr;
+  }
+  return result;
+}
+
 void map_init(var_p_t map) {
   assert(map->type == V_INT);
   v_init(map);
   hashmap_create(map, 0);
 }
 
+void map_init_size(var_p_t map, int size) {
+  assert(map->type == V_INT);
+  v_init(map);
+  hashmap_create(map, size);
+}
+
 void map_init_id(var_p_t map, int id, int cls_id) {
   map_init(map);
   map->v.m.id = id;
@@ -424,18 +557,20 @@ var_num_t get_param_num_field(int argc, slib_par_t *params, int n, const char *f
 
 const char *get_param_str(int argc, slib_par_t *params, int n, const char *def) {
   const char *result;
-  static char buf[256];
+  char *buf;
   if (n >= 0 && n < argc) {
     switch (params[n].var_p->type) {
     case V_STR:
       result = params[n].var_p->v.p.ptr;
       break;
     case V_INT:
-      sprintf(buf, "%lld", params[n].var_p->v.i);
+      buf = scratch_buffer(SCRATCH_NUMBER_SIZE);
+      snprintf(buf, SCRATCH_NUMBER_SIZE, "%lld", (long long)params[n].var_p->v.i);
       result = buf;
       break;
     case V_NUM:
-      sprintf(buf, "%f", params[n].var_p->v.n);
+      buf = scratch_buffer(SCRATCH_NUMBER_SIZE);
+      snprintf(buf, SCRATCH_NUMBER_SIZE, "%f", params[n].var_p->v.n);
       result = buf;
       break;
     default:
@@ -468,6 +603,11 @@ var_num_t get_map_num(var_p_t map, const char *name) {
   return var != nullptr ? get_num(var) : 0;
 }
 
+var_num_t get_map_num_h(var_p_t map, const MapKey &key) {
+  var_p_t var = map_get_h(map, key);
+  return var != nullptr ? get_num(var) : 0;
+}
+
 var_num_t get_array_elem_num(var_p_t array, int index) {
   float result;
   int size = v_asize(array);
@@ -479,6 +619,116 @@ var_num_t get_array_elem_num(var_p_t array, int index) {
   return result;
 }
 
+uint32_t buffer_elem_size(BufferType type) {
+  uint32_t result;
+  switch (type) {
+  case kBufferI16:
+    result = sizeof(int16_t);
+    break;
+  case kBufferI32:
+  case kBufferF32:
+    result = sizeof(int32_t);
+    break;
+  case kBufferF64:
+    result = sizeof(double);
+    break;
+  default:
+    result = sizeof(uint8_t);
+    break;
+  }
+  return result;
+}
+
+//
+// converts to an integer within [low, high], out of range values saturate and NaN becomes zero
+//
+static int64_t buffer_elem_int(var_num_t value, int64_t low, int64_t high) {
+  int64_t result;
+  if (value != value) {
+    result = 0;
+  } else if (value <= (var_num_t)low) {
+    result = low;
+  } else if (value >= (var_num_t)high) {
+    result = high;
+  } else {
+    result = (int64_t)value;
+  }
+  return result;
+}
+
+static void buffer_set_elem(TypedBuffer *buffer, uint32_t index, var_num_t value) {
+  switch (buffer->_type) {
+  case kBufferU8:
+    ((uint8_t *)buffer->_data)[index] = (uint8_t)buffer_elem_int(value, 0, UINT8_MAX);
+    break;
+  case kBufferI16:
+    ((int16_t *)buffer->_data)[index] = (int16_t)buffer_elem_int(value, INT16_MIN, INT16_MAX);
+    break;
+  case kBufferI32:
+    ((int32_t *)buffer->_data)[index] = (int32_t)buffer_elem_int(value, INT32_MIN, INT32_MAX);
+    break;
+  case kBufferF32:
+    ((float *)buffer->_data)[index] = (float)value;
+    break;
+  case kBufferF64:
+    ((double *)buffer->_data)[index] = value;
+    break;
+  }
+}
+
+bool get_param_buffer(int argc, slib_par_t *params, int n, BufferType type, TypedBuffer *buffer) {
+  bool result;
+  uint32_t elem_size = buffer_elem_size(type);
+  buffer->_data = nullptr;
+  buffer->_length = 0;
+  buffer->_type = type;
+  buffer->_owner = false;
+  if (is_param_str(argc, params, n)) {
+    // reference the string bytes directly
+    var_p_t var = params[n].var_p;
+    buffer->_data = var->v.p.ptr;
+    buffer->_length = v_strlen(var) / elem_size;
+    result = true;
+  } else if (is_param_array(argc, params, n)) {
+    var_p_t var = params[n].var_p;
+    uint32_t size = v_asize(var);
+    if (size) {
+      buffer->_data = malloc(size * elem_size);
+      buffer->_owner = true;
+      buffer->_length = size;
+      for (uint32_t i = 0; i < size; i++) {
+        buffer_set_elem(buffer, i, get_num(v_elem(var, i)));
+      }
+    }
+    result = true;
+  } else {
+    result = false;
+  }
+  return result;
+}
+
+void buffer_free(TypedBuffer *buffer) {
+  if (buffer->_owner) {
+    free(buffer->_data);
+  }
+  buffer->_data = nullptr;
+  buffer->_length = 0;
+  buffer->_owner = false;
+}
+
+void v_setbuffer(var_t *var, const void *data, BufferType type, uint32_t length) {
+  uint32_t size = length * buffer_elem_size(type);
+  v_free(var);
+  var->type = V_STR;
+  var->v.p.ptr = (char *)malloc(size + 1);
+  var->v.p.length = size + 1;
+  var->v.p.owner = 1;
+  if (data != nullptr) {
+    memcpy(var->v.p.ptr, data, size);
+  }
+  var->v.p.ptr[size] = '\0';
+}
+
 int is_format_char(char c) {
   static char specifiers[] = {'d', 'i', 'u', 'o', 'x', 'X', 'f', 'F', 'e', 'E', 'g', 'G', 'a', 'A', 'c', 's', 'n'};
   static int len = sizeof(specifiers) / sizeof(char);
@@ -490,18 +740,13 @@ int is_format_char(char c) {
 }
 
 const char *format_text(int argc, slib_par_t *params, int param) {
-  // supported for inline use only
-  static char buffer[MAX_TEXT_BUFFER_LENGTH];
+  // result remains valid until further format_text/get_param_str calls on this thread
   const char *format = get_param_str(argc, params, param++, "");
   const char *start = format;
-  const int padding = 10;
-
-  char *end = (char *)format;
-  int length = 0;
+  const char *end = format;
+  std::string buffer;
   bool error = false;
 
-  memset(buffer, '\0', MAX_TEXT_BUFFER_LENGTH);
-
   while (*end != '\0' && !error) {
     if (*end != '%' || param == argc) {
       end++;
@@ -513,56 +758,51 @@ const char *format_text(int argc, slib_par_t *params, int param) {
           // skip terminating format symbol
           char formatChar = *end;
           end++;
-          int segLength = end - start;
-          if (segLength + length + padding < MAX_TEXT_BUFFER_LENGTH) {
-            char cNull = *end;
-            int maxChars = MAX_TEXT_BUFFER_LENGTH - length;
-            int count;
-            *end = '\0';
-            // append to buffer, process the next single var-arg
-            switch (params[param].var_p->type) {
-            case V_INT:
-              if (formatChar == 'f') {
-                double value =  (double)params[param].var_p->v.i;
-                count = snprintf(buffer + length, maxChars, start, value);
-              } else if (formatChar != 's') {
-                count = snprintf(buffer + length, maxChars, start, params[param].var_p->v.i);
-              } else {
-                count = -1;
-              }
-              break;
-            case V_NUM:
-              if (formatChar != 's') {
-                count = snprintf(buffer + length, maxChars, start, params[param].var_p->v.n);
-              } else {
-                count = -1;
-              }
-              break;
-            case V_STR:
-              if (formatChar == 's') {
-                count = snprintf(buffer + length, maxChars, start, params[param].var_p->v.p.ptr);
-              } else {
-                count = -1;
-              }
-              break;
-            default:
+          std::string segment(start, end - start);
+          int count;
+          // append to buffer, process the next single var-arg
+          switch (params[param].var_p->type) {
+          case V_INT:
+            if (formatChar == 'f') {
+              count = append_format(buffer, segment.c_str(), (double)params[param].var_p->v.i);
+            } else if (formatChar != 's') {
+              count = append_format(buffer, segment.c_str(), params[param].var_p->v.i);
+            } else {
               count = -1;
-              break;
             }
-            param++;
-            length += count;
-            *end = cNull;
-            start = end;
-            if (count < 0 || count >= maxChars) {
-              error = true;
-              break;
+            break;
+          case V_NUM:
+            if (formatChar != 's') {
+              count = append_format(buffer, segment.c_str(), params[param].var_p->v.n);
+            } else {
+              count = -1;
             }
+            break;
+          case V_STR:
+            if (formatChar == 's') {
+              count = append_format(buffer, segment.c_str(), params[param].var_p->v.p.ptr);
+            } else {
+              count = -1;
+            }
+            break;
+          default:
+            count = -1;
+            break;
+          }
+          param++;
+          start = end;
+          if (count < 0) {
+            error = true;
           }
           break;
         } else if (*end != '.' && !isdigit(*end)) {
-          // non-formatting symbol
-          buffer[length++] = *end;
-          buffer[length] = '\0';
+          // non-formatting symbol, keep the preceding text
+          const char *percent = end - 1;
+          while (*percent != '%') {
+            percent--;
+          }
+          buffer.append(start, percent - start);
+          buffer.push_back(*end);
           end++;
           start = end;
           break;
@@ -572,17 +812,13 @@ const char *format_text(int argc, slib_par_t *params, int param) {
   }
 
   if (error) {
-    memset(buffer, '\0', MAX_TEXT_BUFFER_LENGTH);
-    sprintf(buffer, "ERROR: Invalid text format: %s", format);
+    buffer = "ERROR: Invalid text format: ";
+    buffer.append(format);
   } else {
-    int segLength = end - start;
-    if (segLength && (segLength + length + padding < MAX_TEXT_BUFFER_LENGTH)) {
-      strncpy(buffer + length, start, segLength);
-      buffer[length + segLength + 1] = '\0';
-    }
+    buffer.append(start, end - start);
   }
 
-  return buffer;
+  return scratch_copy(buffer);
 }
 
 void v_create_func(var_p_t map, const char *name, method cb) {
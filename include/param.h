@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <stddef.h>
 #include "config.h"
 #include "var.h"
 #include "module.h"
@@ -23,14 +24,51 @@ typedef struct FUNC_SIG {
   int (*_command)(int, slib_par_t *, var_t *retval);
 } FUNC_SIG;
 
+//
+// a map key with a precomputed length and hash, for use in hot paths.
+// the name must have static storage, it is shared by the keys of maps
+// created with map_add_var_h
+//
+// static const MapKey KEY_X = map_key("x");
+// get_map_num_h(map, KEY_X);
+//
+typedef struct MapKey {
+  const char *_name;
+  int _length;
+  int _hash;
+} MapKey;
+
+//
+// packed numeric data exchanged with BASIC. a string argument is used in
+// place as a raw block of elements, while an array argument is converted
+// into an owned block in a single pass.
+//
+typedef enum BufferType {
+  kBufferU8,
+  kBufferI16,
+  kBufferI32,
+  kBufferF32,
+  kBufferF64
+} BufferType;
+
+typedef struct TypedBuffer {
+  void *_data;
+  uint32_t _length;
+  BufferType _type;
+  bool _owner;
+} TypedBuffer;
+
 void error(var_p_t var, const char *field, int nMin, int nMax);
 void error(var_p_t var, const char *field, int n);
 void error(var_p_t var, const char *text);
 void map_init(var_p_t map);
 void map_init_id(var_p_t map, int id, int cls_id = -1);
+void map_init_size(var_p_t map, int size);
 void map_set_int(var_p_t base, const char *name, var_int_t n);
 void v_free(var_t *var);
+void v_setbuffer(var_t *var, const void *data, BufferType type, uint32_t length);
 void v_setstrn(var_t *var, const char *str, int length);
+void v_setstr_move(var_t *var, char *str);
 bool get_bool(var_p_t var);
 bool is_array(var_p_t var, uint32_t size);
 bool is_map(var_p_t var);
@@ -43,6 +81,9 @@ bool is_param_nil(int argc, slib_par_t *params, int n);
 int map_get_bool(var_p_t base, const char *name);
 int map_get_int(var_p_t base, const char *name, int def);
 int get_id(slib_par_t *params, int n);
+bool get_param_buffer(int argc, slib_par_t *params, int n, BufferType type, TypedBuffer *buffer);
+void buffer_free(TypedBuffer *buffer);
+uint32_t buffer_elem_size(BufferType type);
 int get_param_int(int argc, slib_par_t *params, int n, int def);
 var_int_t get_param_int_t(int argc, slib_par_t *params, int n, int def);
 int set_param_int(int argc, slib_par_t *params, int n, int value, var_t *retval);
@@ -53,9 +94,14 @@ var_num_t get_map_num(var_p_t map, const char *name);
 var_num_t get_array_elem_num(var_p_t array, int index);
 var_p_t map_add_var(var_p_t base, const char *name, int value);
 var_p_t map_get(var_p_t base, const char *name);
+MapKey map_key(const char *name);
+var_p_t map_add_var_h(var_p_t base, const MapKey &key, int value);
+var_p_t map_get_h(var_p_t base, const MapKey &key);
+var_num_t get_map_num_h(var_p_t map, const MapKey &key);
 const char *get_param_str(int argc, slib_par_t *params, int n, const char *def);
 const char *get_param_str_field(int argc, slib_par_t *params, int n, const char *field);
 const char *format_text(int argc, slib_par_t *params, int n);
+char *scratch_buffer(size_t size);
 
 #if !defined(SBLIB_API)
  #if defined(_WIN32)
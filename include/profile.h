@@ -0,0 +1,169 @@
+// This file is part of SmallBASIC
+//
+// Optional per-command call profiling for the sblib_xxx_exec entry points
+//
+// Enable by setting SBLIB_PROFILE in the environment before starting sbasic:
+//   SBLIB_PROFILE=1            report to stderr when the module is unloaded
+//   SBLIB_PROFILE=/tmp/x.txt   append the report to the given file
+//
+// This program is distributed under the terms of the GPL v2.0 or later
+// Download the GNU Public License (GPL) from www.gnu.org
+//
+// Copyright(C) 2026 Chris Warren-Smith
+
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "param.h"
+
+#define PROFILE_BUCKETS 40
+
+struct ProfileEntry {
+  const char *_name;
+  uint64_t _calls;
+  uint64_t _total_ns;
+  uint64_t _max_ns;
+  uint64_t _bytes;
+  // _histogram[i] counts calls taking [2^i, 2^(i+1)) nanoseconds
+  uint32_t _histogram[PROFILE_BUCKETS];
+};
+
+struct Profiler {
+  Profiler() : _enabled(false), _output(nullptr) {
+    const char *env = getenv("SBLIB_PROFILE");
+    if (env != nullptr && env[0] != '\0' && strcmp(env, "0") != 0) {
+      _enabled = true;
+      _output = env;
+    }
+  }
+
+  ~Profiler() {
+    if (_enabled) {
+      dump();
+    }
+  }
+
+  bool enabled() const { return _enabled; }
+
+  void record(bool is_func, int index, const char *name, uint64_t ns, uint64_t bytes) {
+    std::vector<ProfileEntry> &entries = is_func ? _funcs : _procs;
+    if (index >= (int)entries.size()) {
+      entries.resize(index + 1, ProfileEntry());
+    }
+    ProfileEntry &entry = entries[index];
+    entry._name = name;
+    entry._calls++;
+    entry._total_ns += ns;
+    entry._bytes += bytes;
+    if (ns > entry._max_ns) {
+      entry._max_ns = ns;
+    }
+    int bucket = 0;
+    while (bucket < PROFILE_BUCKETS - 1 && (ns >> (bucket + 1)) != 0) {
+      bucket++;
+    }
+    entry._histogram[bucket]++;
+  }
+
+  void dump() {
+    FILE *out = stderr;
+    bool close = false;
+    if (strcmp(_output, "1") != 0) {
+      FILE *file = fopen(_output, "a");
+      if (file != nullptr) {
+        out = file;
+        close = true;
+      }
+    }
+    fprintf(out, "%-32s %10s %12s %10s %10s %10s %10s %12s\n",
+            "name", "calls", "total_us", "mean_ns", "p50_ns", "p99_ns", "max_ns", "bytes");
+    dump(out, _funcs);
+    dump(out, _procs);
+    if (close) {
+      fclose(out);
+    }
+  }
+
+  private:
+  // upper bound of the bucket holding the given percentile
+  static uint64_t percentile(const ProfileEntry &entry, double pct) {
+    uint64_t target = (uint64_t)(entry._calls * pct);
+    uint64_t seen = 0;
+    for (int i = 0; i < PROFILE_BUCKETS; i++) {
+      seen += entry._histogram[i];
+      if (seen > target) {
+        return (uint64_t)2 << i;
+      }
+    }
+    return entry._max_ns;
+  }
+
+  static void dump(FILE *out, const std::vector<ProfileEntry> &entries) {
+    for (const ProfileEntry &entry : entries) {
+      if (entry._calls) {
+        fprintf(out, "%-32s %10llu %12llu %10llu %10llu %10llu %10llu %12llu\n",
+                entry._name,
+                (unsigned long long)entry._calls,
+                (unsigned long long)(entry._total_ns / 1000),
+                (unsigned long long)(entry._total_ns / entry._calls),
+                (unsigned long long)percentile(entry, 0.50),
+                (unsigned long long)percentile(entry, 0.99),
+                (unsigned long long)entry._max_ns,
+                (unsigned long long)entry._bytes);
+      }
+    }
+  }
+
+  bool _enabled;
+  const char *_output;
+  std::vector<ProfileEntry> _funcs;
+  std::vector<ProfileEntry> _procs;
+};
+
+inline Profiler &profiler() {
+  static Profiler instance;
+  return instance;
+}
+
+//
+// approximate number of bytes crossing the module boundary for the variable
+//
+inline uint64_t profile_var_size(const var_t *var) {
+  uint64_t result;
+  switch (var->type) {
+  case V_STR:
+    result = var->v.p.length;
+    break;
+  case V_ARRAY:
+    result = (uint64_t)var->v.a.size * sizeof(var_t);
+    break;
+  case V_MAP:
+    result = (uint64_t)var->v.m.count * 2 * sizeof(var_t);
+    break;
+  default:
+    result = sizeof(var_t);
+    break;
+  }
+  return result;
+}
+
+//
+// invokes the command while recording its latency and marshalled size
+//
+inline int profile_exec(bool is_func, int index, const FUNC_SIG &sig, int argc, slib_par_t *params, var_t *retval) {
+  auto start = std::chrono::steady_clock::now();
+  int result = sig._command(argc, params, retval);
+  auto end = std::chrono::steady_clock::now();
+  uint64_t bytes = profile_var_size(retval);
+  for (int i = 0; i < argc; i++) {
+    bytes += profile_var_size(params[i].var_p);
+  }
+  uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+  profiler().record(is_func, index, sig._name, ns, bytes);
+  return result;
+}
@@ -371,6 +371,17 @@ void v_setstr(var_t *var, const char *string);
  */
 void v_setstrn(var_t *var, const char *string, int len);
 
+/**
+ * @ingroup var
+ *
+ * sets the string value of 'var' by taking ownership of the given
+ * malloc'd, null terminated string without copying it
+ *
+ * @param var is the variable
+ * @param string is the string
+ */
+void v_setstr_move(var_t *var, char *string);
+
 /**
  * @ingroup var
  *
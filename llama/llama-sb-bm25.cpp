@@ -0,0 +1,186 @@
+// This file is part of SmallBASIC
+//
+// BM25 inverted index for lexical RAG retrieval
+//
+// This program is distributed under the terms of the GPL v2.0 or later
+// Download the GNU Public License (GPL) from www.gnu.org
+//
+// Copyright(C) 2026 Chris Warren-Smith
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+
+#include "llama-sb-bm25.h"
+
+static constexpr uint64_t FNV_OFFSET = 14695981039346656037ull;
+static constexpr uint64_t FNV_PRIME = 1099511628211ull;
+
+/* term frequency saturation and document length normalization */
+static constexpr float K1 = 1.2f;
+static constexpr float B = 0.75f;
+
+/* shorter tokens, and plain numbers, are too common to be worth indexing */
+static constexpr size_t TOKEN_MIN = 2;
+
+struct Posting {
+  uint64_t term;
+  uint32_t id;
+  uint32_t freq;
+};
+
+static bool is_word(char c) {
+  return isalnum((unsigned char)c) || c == '_';
+}
+
+static void add_token(std::string_view token, std::vector<uint64_t> &terms) {
+  if (token.size() >= TOKEN_MIN &&
+      !std::all_of(token.begin(), token.end(), [](char c) { return isdigit((unsigned char)c); })) {
+    uint64_t hash = FNV_OFFSET;
+    for (char c : token) {
+      hash = (hash ^ (uint8_t)tolower((unsigned char)c)) * FNV_PRIME;
+    }
+    terms.push_back(hash);
+  }
+}
+
+void bm25_tokens(std::string_view text, std::vector<uint64_t> &terms) {
+  size_t i = 0;
+  while (i < text.size()) {
+    if (!is_word(text[i])) {
+      i++;
+      continue;
+    }
+    size_t start = i;
+    while (i < text.size() && is_word(text[i])) {
+      i++;
+    }
+    std::string_view word = text.substr(start, i - start);
+    add_token(word, terms);
+
+    // the parts of snake_case and camelCase identifiers are terms as well
+    size_t part = 0;
+    for (size_t j = 1; j <= word.size(); j++) {
+      bool end = j == word.size() || word[j] == '_' ||
+        (isupper((unsigned char)word[j]) && !isupper((unsigned char)word[j - 1]) && word[j - 1] != '_');
+      if (end) {
+        if (part != 0 || j != word.size()) {
+          add_token(word.substr(part, j - part), terms);
+        }
+        part = j < word.size() && word[j] == '_' ? j + 1 : j;
+      }
+    }
+  }
+}
+
+size_t bm25_size(int n_terms, uint32_t n_postings, size_t n_chunks) {
+  return sizeof(uint64_t) * (1 + n_terms) + sizeof(uint32_t) * (n_terms + 1 + 2 * (size_t)n_postings + n_chunks);
+}
+
+Bm25Index bm25_view(const void *data, int n_terms, uint32_t n_postings, size_t n_chunks) {
+  Bm25Index result;
+  const uint64_t *total = (const uint64_t *)data;
+  result.n_terms = n_terms;
+  result.n_postings = n_postings;
+  result.n_chunks = n_chunks;
+  result.avg_length = n_chunks > 0 ? (float)((double)*total / n_chunks) : 0.0f;
+  result.terms = total + 1;
+  result.offsets = (const uint32_t *)(result.terms + n_terms);
+  result.ids = result.offsets + n_terms + 1;
+  result.freqs = result.ids + n_postings;
+  result.lengths = result.freqs + n_postings;
+  return result;
+}
+
+bool bm25_valid(const Bm25Index &index) {
+  bool result = index.offsets[0] == 0 && index.offsets[index.n_terms] == index.n_postings;
+  for (int i = 0; result && i < index.n_terms; i++) {
+    result = index.offsets[i] < index.offsets[i + 1];
+  }
+  for (uint32_t i = 0; result && i < index.n_postings; i++) {
+    result = index.ids[i] < index.n_chunks;
+  }
+  return result;
+}
+
+void bm25_build(size_t n_chunks, const std::function<std::string_view(size_t idx)> &text,
+                std::vector<uint64_t> &data, int &n_terms, uint32_t &n_postings) {
+  std::vector<Posting> postings;
+  std::vector<uint32_t> lengths(n_chunks);
+  std::vector<uint64_t> tokens;
+  uint64_t total = 0;
+  for (size_t i = 0; i < n_chunks; i++) {
+    tokens.clear();
+    bm25_tokens(text(i), tokens);
+    lengths[i] = (uint32_t)tokens.size();
+    total += tokens.size();
+    std::sort(tokens.begin(), tokens.end());
+    for (size_t j = 0; j < tokens.size();) {
+      size_t k = j;
+      while (k < tokens.size() && tokens[k] == tokens[j]) {
+        k++;
+      }
+      postings.push_back(Posting{tokens[j], (uint32_t)i, (uint32_t)(k - j)});
+      j = k;
+    }
+  }
+
+  // group by term, the chunks of each term staying in ascending order
+  std::sort(postings.begin(), postings.end(), [](const Posting &a, const Posting &b) {
+    return a.term != b.term ? a.term < b.term : a.id < b.id;
+  });
+
+  n_terms = 0;
+  for (size_t i = 0; i < postings.size(); i++) {
+    if (i == 0 || postings[i].term != postings[i - 1].term) {
+      n_terms++;
+    }
+  }
+  n_postings = (uint32_t)postings.size();
+  data.assign((bm25_size(n_terms, n_postings, n_chunks) + 7) / 8, 0);
+  data[0] = total;
+
+  Bm25Index index = bm25_view(data.data(), n_terms, n_postings, n_chunks);
+  uint64_t *terms = const_cast<uint64_t *>(index.terms);
+  uint32_t *offsets = const_cast<uint32_t *>(index.offsets);
+  uint32_t *ids = const_cast<uint32_t *>(index.ids);
+  uint32_t *freqs = const_cast<uint32_t *>(index.freqs);
+  int term = -1;
+  for (size_t i = 0; i < postings.size(); i++) {
+    if (i == 0 || postings[i].term != postings[i - 1].term) {
+      terms[++term] = postings[i].term;
+      offsets[term] = (uint32_t)i;
+    }
+    ids[i] = postings[i].id;
+    freqs[i] = postings[i].freq;
+  }
+  offsets[n_terms] = n_postings;
+  std::copy(lengths.begin(), lengths.end(), const_cast<uint32_t *>(index.lengths));
+}
+
+void bm25_search(const Bm25Index &index, std::string_view query, std::vector<float> &scores) {
+  scores.assign(index.n_chunks, 0.0f);
+  std::vector<uint64_t> terms;
+  bm25_tokens(query, terms);
+  std::sort(terms.begin(), terms.end());
+  terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+
+  const uint64_t *end = index.terms + index.n_terms;
+  for (uint64_t hash : terms) {
+    const uint64_t *it = std::lower_bound(index.terms, end, hash);
+    if (it == end || *it != hash) {
+      continue;
+    }
+    size_t term = it - index.terms;
+    uint32_t first = index.offsets[term];
+    uint32_t last = index.offsets[term + 1];
+    float df = (float)(last - first);
+    float idf = std::log(1.0f + (index.n_chunks - df + 0.5f) / (df + 0.5f));
+    for (uint32_t i = first; i < last; i++) {
+      uint32_t id = index.ids[i];
+      float tf = (float)index.freqs[i];
+      float norm = K1 * (1.0f - B + B * index.lengths[id] / index.avg_length);
+      scores[id] += idf * tf * (K1 + 1.0f) / (tf + norm);
+    }
+  }
+}
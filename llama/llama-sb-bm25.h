@@ -0,0 +1,70 @@
+// This file is part of SmallBASIC
+//
+// BM25 inverted index for lexical RAG retrieval
+//
+// Identifiers are indexed whole and by their parts, so that a query naming
+// ncplane_putstr or putstr finds the chunks declaring it even when the
+// embedding ranks them below chunks that merely talk about output.
+//
+// This program is distributed under the terms of the GPL v2.0 or later
+// Download the GNU Public License (GPL) from www.gnu.org
+//
+// Copyright(C) 2026 Chris Warren-Smith
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include <vector>
+
+//
+// view over the index arrays, either owned or inside a mapped RAGD file
+//
+struct Bm25Index {
+  int      n_terms = 0;
+  uint32_t n_postings = 0;
+  size_t   n_chunks = 0;
+  float    avg_length = 0.0f;
+  const uint64_t *terms = nullptr;      /* n_terms term hashes, ascending               */
+  const uint32_t *offsets = nullptr;    /* n_terms + 1, term i is postings[offsets[i]..i+1] */
+  const uint32_t *ids = nullptr;        /* chunk numbers of each posting, ascending per term */
+  const uint32_t *freqs = nullptr;      /* occurrences of the term in the chunk          */
+  const uint32_t *lengths = nullptr;    /* n_chunks, tokens in each chunk                */
+
+  bool empty() const { return n_terms == 0; }
+};
+
+//
+// hashes of the tokens in text, in order and with repeats
+//
+void bm25_tokens(std::string_view text, std::vector<uint64_t> &terms);
+
+//
+// bytes used by the index arrays, laid out as the token total, terms, offsets,
+// ids, freqs then lengths
+//
+size_t bm25_size(int n_terms, uint32_t n_postings, size_t n_chunks);
+
+//
+// indexes the text of every chunk, replacing data with the index arrays
+//
+void bm25_build(size_t n_chunks, const std::function<std::string_view(size_t idx)> &text,
+                std::vector<uint64_t> &data, int &n_terms, uint32_t &n_postings);
+
+//
+// points an index view at arrays written by bm25_build
+//
+Bm25Index bm25_view(const void *data, int n_terms, uint32_t n_postings, size_t n_chunks);
+
+//
+// whether the offsets and ids of a view read from a file stay within the postings
+// and chunks, so that searching it stays within the arrays
+//
+bool bm25_valid(const Bm25Index &index);
+
+//
+// the BM25 score of every chunk for the query, zero where no query term occurs
+//
+void bm25_search(const Bm25Index &index, std::string_view query, std::vector<float> &scores);
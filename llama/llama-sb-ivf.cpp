@@ -0,0 +1,197 @@
+// This file is part of SmallBASIC
+//
+// Inverted file (IVF) approximate nearest-neighbour index for RAG retrieval
+//
+// This program is distributed under the terms of the GPL v2.0 or later
+// Download the GNU Public License (GPL) from www.gnu.org
+//
+// Copyright(C) 2026 Chris Warren-Smith
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <random>
+
+#include "llama-sb-ivf.h"
+#include "llama-sb-simd.h"
+
+/* k-means trains on a sample of this many rows per list */
+static constexpr size_t TRAIN_PER_LIST = 64;
+static constexpr int TRAIN_ITERATIONS = 8;
+
+/* suggested lists probed per query, see the rag_bench results in RAG.md */
+static constexpr int PROBE_DIV = 8;
+static constexpr int PROBE_MIN = 8;
+static constexpr int LISTS_MIN = 16;
+
+//
+// index of the centroid nearest to the row
+//
+static int nearest(const float *centroids, int n_lists, int dim, const float *row, std::vector<float> &scores) {
+  simd_dot_rows(centroids, n_lists, dim, row, scores.data());
+  return (int)(std::max_element(scores.begin(), scores.end()) - scores.begin());
+}
+
+static void normalize(float *v, int dim) {
+  float norm = std::sqrt(simd_dot(v, v, dim));
+  if (norm > 0.0f) {
+    for (int i = 0; i < dim; i++) {
+      v[i] /= norm;
+    }
+  }
+}
+
+int ivf_lists(size_t n_rows) {
+  // sqrt(n) lists of sqrt(n) rows balances the centroid scan against the list scan
+  int result = (int)std::lround(std::sqrt((double)n_rows));
+  return std::min((int)n_rows, std::max(result, LISTS_MIN));
+}
+
+int ivf_probe(int n_lists) {
+  return std::min(n_lists, std::max(n_lists / PROBE_DIV, PROBE_MIN));
+}
+
+size_t ivf_size(int n_lists, size_t n_rows, int dim) {
+  return ((size_t)n_lists * dim + n_lists + 1 + n_rows) * sizeof(uint32_t);
+}
+
+IvfIndex ivf_view(const void *data, int n_lists, int n_probe, int dim) {
+  IvfIndex result;
+  result.n_lists = n_lists;
+  result.n_probe = n_probe;
+  result.dim = dim;
+  result.centroids = (const float *)data;
+  result.offsets = (const uint32_t *)(result.centroids + (size_t)n_lists * dim);
+  result.ids = result.offsets + n_lists + 1;
+  return result;
+}
+
+bool ivf_valid(const IvfIndex &index, size_t n_rows) {
+  bool result = index.offsets[0] == 0 && index.offsets[index.n_lists] == n_rows;
+  for (int i = 0; result && i < index.n_lists; i++) {
+    result = index.offsets[i] <= index.offsets[i + 1];
+  }
+  for (size_t i = 0; result && i < n_rows; i++) {
+    result = index.ids[i] < n_rows;
+  }
+  return result;
+}
+
+int ivf_nearest(const IvfIndex &index, const float *row) {
+  std::vector<float> scores(index.n_lists);
+  return nearest(index.centroids, index.n_lists, index.dim, row, scores);
+}
+
+void ivf_relist(const uint32_t *row_lists, size_t n_rows, int n_lists, int dim, void *data) {
+  uint32_t *offsets = (uint32_t *)((float *)data + (size_t)n_lists * dim);
+  uint32_t *ids = offsets + n_lists + 1;
+  std::fill(offsets, offsets + n_lists + 1, 0);
+  for (size_t i = 0; i < n_rows; i++) {
+    offsets[row_lists[i] + 1]++;
+  }
+  for (int i = 0; i < n_lists; i++) {
+    offsets[i + 1] += offsets[i];
+  }
+  std::vector<uint32_t> next(offsets, offsets + n_lists);
+  for (size_t i = 0; i < n_rows; i++) {
+    ids[next[row_lists[i]]++] = (uint32_t)i;
+  }
+}
+
+void ivf_row_lists(const IvfIndex &index, size_t n_rows, std::vector<uint32_t> &row_lists) {
+  row_lists.assign(n_rows, 0);
+  for (int list = 0; list < index.n_lists; list++) {
+    for (uint32_t j = index.offsets[list]; j < index.offsets[list + 1]; j++) {
+      row_lists[index.ids[j]] = (uint32_t)list;
+    }
+  }
+}
+
+void ivf_build(const float *matrix, size_t n_rows, int dim, int n_lists, void *data) {
+  float *centroids = (float *)data;
+
+  // seeded from the size so that rebuilding the same index gives the same lists
+  std::mt19937 rng((uint32_t)n_rows);
+  std::vector<uint32_t> sample(n_rows);
+  std::iota(sample.begin(), sample.end(), 0);
+  std::shuffle(sample.begin(), sample.end(), rng);
+  sample.resize(std::min(n_rows, (size_t)n_lists * TRAIN_PER_LIST));
+
+  for (int i = 0; i < n_lists; i++) {
+    memcpy(centroids + (size_t)i * dim, matrix + (size_t)sample[i % sample.size()] * dim, dim * sizeof(float));
+  }
+
+  std::vector<float> scores(n_lists);
+  std::vector<int> assign(sample.size());
+  std::vector<float> sums((size_t)n_lists * dim);
+  std::vector<int> counts(n_lists);
+  for (int iteration = 0; iteration < TRAIN_ITERATIONS; iteration++) {
+    for (size_t i = 0; i < sample.size(); i++) {
+      assign[i] = nearest(centroids, n_lists, dim, matrix + (size_t)sample[i] * dim, scores);
+    }
+    std::fill(sums.begin(), sums.end(), 0.0f);
+    std::fill(counts.begin(), counts.end(), 0);
+    for (size_t i = 0; i < sample.size(); i++) {
+      const float *row = matrix + (size_t)sample[i] * dim;
+      float *sum = sums.data() + (size_t)assign[i] * dim;
+      for (int j = 0; j < dim; j++) {
+        sum[j] += row[j];
+      }
+      counts[assign[i]]++;
+    }
+    for (int i = 0; i < n_lists; i++) {
+      float *centroid = centroids + (size_t)i * dim;
+      if (counts[i] == 0) {
+        // reseed an empty list from a random row
+        memcpy(centroid, matrix + (size_t)sample[rng() % sample.size()] * dim, dim * sizeof(float));
+      } else {
+        memcpy(centroid, sums.data() + (size_t)i * dim, dim * sizeof(float));
+        normalize(centroid, dim);
+      }
+    }
+  }
+
+  // file every row under its nearest centroid
+  std::vector<uint32_t> row_lists(n_rows);
+  for (size_t i = 0; i < n_rows; i++) {
+    row_lists[i] = nearest(centroids, n_lists, dim, matrix + i * dim, scores);
+  }
+  ivf_relist(row_lists.data(), n_rows, n_lists, dim, data);
+}
+
+void ivf_search(const IvfIndex &index, const float *matrix, const float *query,
+                int n_wanted, int n_probe, const std::vector<bool> &skip,
+                std::vector<int> &rows, std::vector<float> &scores) {
+  int dim = index.dim;
+  std::vector<float> centroid_scores(index.n_lists);
+  std::vector<int> lists;
+  simd_dot_rows(index.centroids, index.n_lists, dim, query, centroid_scores.data());
+  simd_top_k(centroid_scores.data(), index.n_lists, index.n_lists, lists);
+
+  std::vector<int> candidates;
+  std::vector<float> candidate_scores;
+  for (int i = 0; i < index.n_lists; i++) {
+    if (i >= n_probe && (int)candidates.size() >= n_wanted) {
+      break;
+    }
+    int list = lists[i];
+    for (uint32_t j = index.offsets[list]; j < index.offsets[list + 1]; j++) {
+      uint32_t row = index.ids[j];
+      if (row < skip.size() && skip[row]) {
+        continue;
+      }
+      candidates.push_back((int)row);
+      candidate_scores.push_back(simd_dot(matrix + (size_t)row * dim, query, dim));
+    }
+  }
+
+  std::vector<int> best;
+  simd_top_k(candidate_scores.data(), (int)candidates.size(), n_wanted, best);
+  rows.clear();
+  scores.clear();
+  for (int i : best) {
+    rows.push_back(candidates[i]);
+    scores.push_back(candidate_scores[i]);
+  }
+}
@@ -0,0 +1,85 @@
+// This file is part of SmallBASIC
+//
+// Inverted file (IVF) approximate nearest-neighbour index for RAG retrieval
+//
+// The embedding rows are clustered around n_lists k-means centroids. A query
+// scores the centroids, then exactly scores only the rows filed under the
+// nearest few lists, so the work per query grows with sqrt(n) rather than n.
+//
+// This program is distributed under the terms of the GPL v2.0 or later
+// Download the GNU Public License (GPL) from www.gnu.org
+//
+// Copyright(C) 2026 Chris Warren-Smith
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//
+// view over the index arrays, either owned or inside a mapped RAGD file
+//
+struct IvfIndex {
+  int n_lists = 0;
+  int n_probe = 0;
+  int dim = 0;
+  const float    *centroids = nullptr;   /* n_lists x dim                              */
+  const uint32_t *offsets = nullptr;     /* n_lists + 1, list i is ids[offsets[i]..i+1] */
+  const uint32_t *ids = nullptr;         /* row numbers grouped by list                 */
+
+  bool empty() const { return n_lists == 0; }
+};
+
+//
+// number of lists and default probe count for an index over n_rows
+//
+int ivf_lists(size_t n_rows);
+int ivf_probe(int n_lists);
+
+//
+// bytes used by the arrays of an index, laid out as centroids, offsets then ids
+//
+size_t ivf_size(int n_lists, size_t n_rows, int dim);
+
+//
+// clusters the L2-normalized rows with spherical k-means and writes the arrays
+// into data, which must hold ivf_size() bytes
+//
+void ivf_build(const float *matrix, size_t n_rows, int dim, int n_lists, void *data);
+
+//
+// the list whose centroid is nearest to the row
+//
+int ivf_nearest(const IvfIndex &index, const float *row);
+
+//
+// rewrites the offsets and ids of the index arrays in data for rows filed under
+// row_lists[i], keeping the centroids
+//
+void ivf_relist(const uint32_t *row_lists, size_t n_rows, int n_lists, int dim, void *data);
+
+//
+// the list of every row, the inverse of the offsets and ids
+//
+void ivf_row_lists(const IvfIndex &index, size_t n_rows, std::vector<uint32_t> &row_lists);
+
+//
+// points an index view at arrays written by ivf_build
+//
+IvfIndex ivf_view(const void *data, int n_lists, int n_probe, int dim);
+
+//
+// whether the offsets and ids of a view read from a file describe n_rows rows,
+// so that searching it stays within the arrays
+//
+bool ivf_valid(const IvfIndex &index, size_t n_rows);
+
+//
+// the n_wanted best rows found in at least n_probe lists, best first, with exact
+// scores. rows flagged in skip are ignored, and further lists are probed until
+// n_wanted rows remain or every list has been visited
+//
+void ivf_search(const IvfIndex &index, const float *matrix, const float *query,
+                int n_wanted, int n_probe, const std::vector<bool> &skip,
+                std::vector<int> &rows, std::vector<float> &scores);
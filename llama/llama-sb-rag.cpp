@@ -7,22 +7,58 @@
 
 #include "llama-sb.h"
 #include "llama-sb-rag.h"
+#include "llama-sb-simd.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <mutex>
 #include <numeric>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
+#if defined(_WIN32)
+ #include <cstdio>
+#else
+ #include <fcntl.h>
+ #include <sys/mman.h>
+ #include <sys/stat.h>
+ #include <unistd.h>
+#endif
+
 namespace fs = std::filesystem;
 
 static constexpr uint32_t MAGIC = 0x52414744;
+static constexpr uint32_t QUERY_MAGIC = 0x52414751;
+static constexpr uint32_t QUERY_VERSION = 1;
+static constexpr uint64_t FNV_OFFSET = 14695981039346656037ull;
+static constexpr uint64_t FNV_PRIME = 1099511628211ull;
 static constexpr size_t MIN_CHUNK = 40;
+
+/* indexing pipeline: chunking threads, files queued per thread, chunks per embedding step */
+static constexpr int CHUNK_THREADS_MAX = 8;
+static constexpr int CHUNK_QUEUE_PER_THREAD = 4;
+static constexpr size_t EMBED_FLUSH = 128;
+
+/* quantized scans keep this many candidates per wanted result for exact rescoring */
+static constexpr int RESCORE_INT8 = 4;
+static constexpr int RESCORE_BINARY = 16;
+static constexpr int RESCORE_MIN = 64;
+
+/* fused ranking takes this many candidates from each ranking, and damps the leaders by RRF_K */
+static constexpr int FUSE_DEPTH = 50;
+static constexpr float RRF_K = 60.0f;
+static constexpr const char *CONTEXT_SEPARATOR = "\n---\n";
 static constexpr const char *INSTRUCT_EMBED = "Instruct: Represent this API documentation for code retrieval\nQuery: ";
 static constexpr const char *INSTRUCT_QUERY = "Instruct: Given a programming question, retrieve relevant API documentation\nQuery: ";
 
@@ -53,6 +89,67 @@ static bool is_blank(const std::string &s) {
   return true;
 }
 
+//
+// maps the whole file read-only, nullptr on failure
+//
+static void *map_file(const std::string &path, size_t &size) {
+  void *result = nullptr;
+#if defined(_WIN32)
+  FILE *fp = fopen(path.c_str(), "rb");
+  if (fp != nullptr) {
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    result = len > 0 ? malloc(len) : nullptr;
+    if (result != nullptr && fread(result, 1, len, fp) != (size_t)len) {
+      free(result);
+      result = nullptr;
+    }
+    size = len;
+    fclose(fp);
+  }
+#else
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd != -1) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      size = st.st_size;
+      result = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+      if (result == MAP_FAILED) {
+        result = nullptr;
+      }
+    }
+    close(fd);
+  }
+#endif
+  return result;
+}
+
+static void unmap_file(void *data, size_t size) {
+#if defined(_WIN32)
+  free(data);
+#else
+  munmap(data, size);
+#endif
+}
+
+static bool file_stat(const std::string &path, uint64_t &size, int64_t &mtime) {
+  std::error_code ec;
+  size = fs::file_size(path, ec);
+  if (!ec) {
+    mtime = (int64_t)fs::last_write_time(path, ec).time_since_epoch().count();
+  }
+  return !ec;
+}
+
+static uint64_t fnv_hash(std::string_view data) {
+  uint64_t result = FNV_OFFSET;
+  for (char c : data) {
+    result = (result ^ (uint8_t)c) * FNV_PRIME;
+  }
+  return result;
+}
+
 /* ── state machine ─────────────────────────────────────────── */
 
 enum class State {
@@ -61,14 +158,7 @@ enum class State {
 
 template<typename EmitChunk>
 
-static bool chunk_file(const fs::path &path, EmitChunk emit_chunk) {
-  std::ifstream f(path);
-  if (!f) {
-    return false;
-  }
-
-  const std::string source = path.filename().string();
-
+static void chunk_text(std::string_view content, const std::string &source, EmitChunk emit_chunk) {
   State     state       = State::Idle;
   std::string chunk;
   ChunkType chunk_type  = ChunkType::Other;
@@ -85,7 +175,15 @@ static bool chunk_file(const fs::path &path, EmitChunk emit_chunk) {
   };
 
   std::string line;
-  while (std::getline(f, line)) {
+  size_t pos = 0;
+  while (pos < content.size()) {
+    size_t eol = content.find('\n', pos);
+    if (eol == std::string_view::npos) {
+      eol = content.size();
+    }
+    line.assign(content.data() + pos, eol - pos);
+    pos = eol + 1;
+
     /* trim trailing CR */
     if (!line.empty() && line.back() == '\r') line.pop_back();
 
@@ -247,61 +345,313 @@ static bool chunk_file(const fs::path &path, EmitChunk emit_chunk) {
 
   /* flush remainder */
   if (chunk.size() >= MIN_CHUNK) emit_chunk(source, chunk_type, chunk);
+}
 
+//
+// reads the file once through a mapping, recording its size, mtime and hash with the chunks
+//
+static bool chunk_file(const std::string &path, RagSourceEntry &state, std::vector<RagChunk> &chunks) {
+  state = {};
+  if (!file_stat(path, state.size, state.mtime)) {
+    return false;
+  }
+  size_t size = 0;
+  void *data = map_file(path, size);
+  if (data == nullptr && state.size != 0) {
+    return false;
+  }
+
+  std::string_view content((const char *)data, data != nullptr ? size : 0);
+  state.hash = fnv_hash(content);
+  chunk_text(content, fs::path(path).filename().string(),
+             [&](const std::string &source, ChunkType type, const std::string &text) {
+    if (text.size() > MIN_CHUNK) {
+      chunks.push_back(RagChunk{text, source, type_name(type)});
+    }
+  });
+  if (data != nullptr) {
+    unmap_file(data, size);
+  }
   return true;
 }
 
 //
-// cosine similarity (vectors already L2-normalized)
+// ranks the chunks by cosine similarity (vectors already L2-normalized). order receives at least
+// the n_wanted best and ranked their exact scores. quantized indexes are scanned approximately
+// and only the leading candidates are rescored against the float rows
 //
-static float rag_cosine(const std::vector<float> &a,
-                        const std::vector<float> &b) {
-  float dot = 0.0f;
-  size_t n = std::min(a.size(), b.size());
-  for (size_t i = 0; i < n; i++) {
-    dot += a[i] * b[i];
+static void rag_score(const RagDB &db, const std::vector<float> &qvec, int n_wanted,
+                      std::vector<int> &order, std::vector<float> &ranked) {
+  int n = db.size();
+  int dim = db.embed_dim;
+  std::vector<float> scores(n);
+
+  int factor;
+  switch (db.quant()) {
+  case RAG_QUANT_INT8: {
+    std::vector<int8_t> q(dim);
+    float q_scale = simd_quantize_i8(qvec.data(), dim, q.data());
+    simd_dot_rows_i8(db.quant_i8(), db.quant_scales(), n, dim, q.data(), q_scale, scores.data());
+    factor = RESCORE_INT8;
+    break;
+  }
+  case RAG_QUANT_BINARY: {
+    std::vector<uint64_t> q((dim + 63) / 64);
+    simd_quantize_bits(qvec.data(), dim, q.data());
+    simd_hamming_rows(db.quant_bits(), n, dim, q.data(), scores.data());
+    factor = RESCORE_BINARY;
+    break;
+  }
+  default:
+    simd_dot_rows(db.matrix(), n, dim, qvec.data(), scores.data());
+    simd_top_k(scores.data(), n, n_wanted, order);
+    factor = 0;
+    break;
+  }
+
+  if (factor != 0) {
+    simd_top_k(scores.data(), n, std::max(n_wanted * factor, RESCORE_MIN), order);
+    for (int idx : order) {
+      scores[idx] = simd_dot(db.embedding(idx), qvec.data(), dim);
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return scores[a] > scores[b]; });
+  }
+
+  ranked.resize(order.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    ranked[i] = scores[order[i]];
+  }
+}
+
+//
+// merges the cosine ranking in order with the BM25 ranking of the query by reciprocal rank
+// fusion, skipping seen chunks. order and scores receive the fused order and its cosine
+// scores, lexical the BM25 score of every chunk
+//
+static void rag_fuse(const RagDB &db, const std::string &query, const std::vector<float> &qvec,
+                     int n_wanted, const RagSession &session, std::vector<int> &order,
+                     std::vector<float> &scores, std::vector<float> &lexical) {
+  int n_seen = (int)std::count(session.seen.begin(), session.seen.end(), true);
+  std::vector<int> lexical_order;
+  bm25_search(db.lexical(), query, lexical);
+  simd_top_k(lexical.data(), db.size(), n_wanted + n_seen, lexical_order);
+
+  std::unordered_map<int, float> fused;
+  std::unordered_map<int, float> cosine;
+  int rank = 0;
+  for (size_t i = 0; i < order.size() && rank < n_wanted; i++) {
+    if (!session.is_seen(order[i])) {
+      fused[order[i]] += 1.0f / (RRF_K + ++rank);
+      cosine[order[i]] = scores[i];
+    }
+  }
+  rank = 0;
+  for (int idx : lexical_order) {
+    if (rank == n_wanted || lexical[idx] <= 0.0f) {
+      break;
+    }
+    if (!session.is_seen(idx)) {
+      fused[idx] += 1.0f / (RRF_K + ++rank);
+      if (!cosine.count(idx)) {
+        cosine[idx] = simd_dot(db.embedding(idx), qvec.data(), db.embed_dim);
+      }
+    }
+  }
+
+  order.clear();
+  for (const auto &it : fused) {
+    order.push_back(it.first);
+  }
+  std::sort(order.begin(), order.end(), [&](int a, int b) {
+    return fused[a] != fused[b] ? fused[a] > fused[b] : cosine[a] > cosine[b];
+  });
+  scores.resize(order.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    scores[i] = cosine[order[i]];
   }
-  return dot;
 }
 
 //
-// build context string from ranked results
+// the line introducing a chunk in the context, the BM25 score is shown when not negative
+//
+static std::string rag_context_header(const RagDB &db, int idx, float score, float lexical) {
+  std::ostringstream out;
+  out << "// source: " << db.source(idx)
+      << " [" << db.type(idx) << "]"
+      << " (score: " << score;
+  if (lexical >= 0.0f) {
+    out << ", bm25: " << lexical;
+  }
+  out << ")\n";
+  return out.str();
+}
+
+//
+// build context string from ranked results, lexical is empty unless the ranking was fused
 //
 static std::string rag_build_context(const RagDB &db,
                                      const std::vector<int> &indices,
-                                     const std::vector<float> &scores) {
-  std::ostringstream out;
+                                     const std::vector<float> &scores,
+                                     const std::vector<float> &lexical) {
+  std::string result;
   for (size_t i = 0; i < indices.size(); i++) {
-    const RagChunk &c = db.chunks[indices[i]];
-    out << "// source: " << c.source
-        << " [" << c.type << "]"
-        << " (score: " << scores[i] << ")\n"
-        << c.text << "\n---\n";
+    int idx = indices[i];
+    result += rag_context_header(db, idx, scores[i], lexical.empty() ? -1.0f : lexical[i]);
+    result += db.text(idx);
+    result += CONTEXT_SEPARATOR;
   }
-  return out.str();
+  return result;
 }
 
 //
 // index the file
 //
 bool Llama::rag_index(RagDB &db, const std::string &filepath) {
-  bool embed_fail = false;
-  auto emit_chunk = [&](const std::string &source, ChunkType type,
-                        const std::string &text) {
-    if (text.size() > MIN_CHUNK) {
-      RagChunk chunk;
-      chunk.text = text;
-      chunk.source = source;
-      chunk.type = type_name(type);
-      if (!embed_text(INSTRUCT_EMBED + text, chunk.embedding, db.embed_dim)) {
-        embed_fail = true;
-      } else {
-        db.chunks.push_back(std::move(chunk));
+  return rag_index(db, std::vector<std::string>{filepath}, nullptr);
+}
+
+//
+// one file read and chunked by a worker thread
+//
+struct ChunkedFile {
+  std::string           path;
+  RagSourceEntry        state;
+  std::vector<RagChunk> chunks;
+  bool                  ok;
+};
+
+//
+// bounded queue from the chunking threads to the embedding stage, so that the
+// readers stay only a few files ahead of the embedding
+//
+class ChunkQueue {
+  public:
+  ChunkQueue(size_t capacity, int producers) :
+    _capacity(capacity),
+    _producers(producers) {
+  }
+
+  void push(ChunkedFile &&file) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _not_full.wait(lock, [this] { return _items.size() < _capacity; });
+    _items.push_back(std::move(file));
+    _not_empty.notify_one();
+  }
+
+  //
+  // false once every producer has finished and the queue is drained
+  //
+  bool pop(ChunkedFile &file) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _not_empty.wait(lock, [this] { return !_items.empty() || _producers == 0; });
+    bool result = !_items.empty();
+    if (result) {
+      file = std::move(_items.front());
+      _items.pop_front();
+      _not_full.notify_one();
+    }
+    return result;
+  }
+
+  void finished() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _producers--;
+    _not_empty.notify_all();
+  }
+
+  private:
+  std::mutex _mutex;
+  std::condition_variable _not_empty;
+  std::condition_variable _not_full;
+  std::deque<ChunkedFile> _items;
+  size_t _capacity;
+  int _producers;
+};
+
+//
+// index the files. worker threads map and chunk the files into a bounded queue while
+// this thread embeds the chunks already read in shared batches. each file is recorded
+// as a source so that a later pass can skip it while it is unchanged. the caller removes
+// any earlier chunks of the files with RagDB::remove_sources
+//
+bool Llama::rag_index(RagDB &db, const std::vector<std::string> &filepaths,
+                      const std::function<void(size_t done, size_t total)> &progress) {
+  int n_threads = std::clamp((int)std::thread::hardware_concurrency() - 1, 1, CHUNK_THREADS_MAX);
+  n_threads = (int)std::min((size_t)n_threads, filepaths.size());
+  if (n_threads == 0) {
+    return true;
+  }
+
+  ChunkQueue queue(n_threads * CHUNK_QUEUE_PER_THREAD, n_threads);
+  std::atomic<size_t> next_file(0);
+  std::atomic<bool> stop(false);
+  std::vector<std::thread> workers;
+  for (int i = 0; i < n_threads; i++) {
+    workers.emplace_back([&]() {
+      for (size_t f = next_file++; f < filepaths.size() && !stop; f = next_file++) {
+        ChunkedFile file;
+        file.path = filepaths[f];
+        file.ok = chunk_file(file.path, file.state, file.chunks);
+        queue.push(std::move(file));
       }
+      queue.finished();
+    });
+  }
+
+  // the llama context is only used from this thread
+  bool result = true;
+  size_t n_done = 0;
+  std::vector<ChunkedFile> pending;
+  std::vector<std::string> texts;
+  auto flush = [&]() -> bool {
+    std::vector<std::vector<float>> embeddings;
+    if (!embed_batch(texts, embeddings, db.embed_dim)) {
+      return false;
+    }
+    size_t next = 0;
+    for (const ChunkedFile &file : pending) {
+      for (const RagChunk &chunk : file.chunks) {
+        db.add(chunk, embeddings[next++].data());
+      }
+      db.add_source(file.path, file.state, (int)file.chunks.size());
+    }
+    n_done += pending.size();
+    pending.clear();
+    texts.clear();
+    if (progress) {
+      progress(n_done, filepaths.size());
     }
+    return true;
   };
 
-  return !embed_fail && chunk_file(filepath, emit_chunk);
+  ChunkedFile file;
+  while (queue.pop(file)) {
+    if (stop) {
+      // keep draining so that workers blocked on a full queue can finish
+      continue;
+    }
+    if (!file.ok) {
+      _last_error = "failed to read " + file.path;
+      n_done++;
+      result = false;
+      continue;
+    }
+    for (const RagChunk &chunk : file.chunks) {
+      texts.push_back(INSTRUCT_EMBED + chunk.text);
+    }
+    pending.push_back(std::move(file));
+    if (texts.size() >= EMBED_FLUSH && !flush()) {
+      stop = true;
+      result = false;
+    }
+  }
+  if (!stop && !pending.empty() && !flush()) {
+    result = false;
+  }
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  return result;
 }
 
 //
@@ -317,79 +667,817 @@ std::string Llama::rag_retrieve(const RagDB &db,
   }
 
   std::vector<float> qvec;
-  std::string text = INSTRUCT_QUERY + query;
-  if (!embed_text(text, qvec, db.embed_dim)) {
-    _last_error = "failed to embed text";
-    return {};
+  if (!session.queries.get(query, qvec) || (int)qvec.size() != db.embed_dim) {
+    std::string text = INSTRUCT_QUERY + query;
+    if (!embed_text(text, qvec, db.embed_dim)) {
+      _last_error = "failed to embed text";
+      return {};
+    }
+    session.queries.put(query, qvec);
   }
 
-  // score all chunks
-  std::vector<int>   order(db.size());
-  std::iota(order.begin(), order.end(), 0);
-  std::vector<float> scores(db.size());
-  for (int i = 0; i < db.size(); i++) {
-    scores[i] = rag_cosine(qvec, db.chunks[i].embedding);
+  // fusion needs enough of each ranking for a chunk ranked well by only one to place, and
+  // spare candidates let smaller chunks replace those too large for the token budget
+  bool fused = session.rank == RAG_RANK_FUSED && !db.lexical().empty();
+  int n_wanted = fused ? std::max(top_k, FUSE_DEPTH) : top_k * 2;
+
+  std::vector<int> order;
+  std::vector<float> scores;
+  std::vector<float> lexical;
+  IvfIndex ann = db.ann();
+  if (!ann.empty() && session.probe > 0) {
+    // seen chunks are skipped while probing, which widens until n_wanted unseen remain
+    int n_probe = std::min(session.probe, ann.n_lists);
+    ivf_search(ann, db.matrix(), qvec.data(), n_wanted, n_probe, session.seen, order, scores);
+  } else {
+    // rank just enough candidates to still find n_wanted after skipping those already seen
+    int n_seen = (int)std::count(session.seen.begin(), session.seen.end(), true);
+    rag_score(db, qvec, n_wanted + n_seen, order, scores);
+  }
+  if (fused) {
+    rag_fuse(db, query, qvec, n_wanted, session, order, scores, lexical);
   }
-  std::sort(order.begin(), order.end(), [&](int a, int b){ return scores[a] > scores[b]; });
 
-  // collect top_k unseen, within budget, above threshold
+  // collect top_k unseen, above threshold, packing each whole entry that fits the budget
   std::vector<int>   result_idx;
   std::vector<float> result_scores;
+  std::vector<float> result_lexical;
+  int separator_tokens = session.tokens(CONTEXT_SEPARATOR);
 
-  for (int idx : order) {
+  for (size_t i = 0; i < order.size(); i++) {
+    int idx = order[i];
     if ((int)result_idx.size() >= top_k) break;
     if (session.is_seen(idx))            continue;
-    if (scores[idx] < session.score_threshold) break; /* sorted, so stop */
-    if (!session.budget_ok(db.chunks[idx].text)) break;
+    if (scores[i] < session.score_threshold) {
+      if (!fused) break;                 /* sorted, so stop */
+      if (lexical[idx] < session.lexical_threshold) continue;
+    }
+
+    int text_tokens = db.tokens(idx, session.vocab);
+    if (text_tokens < 0) {
+      text_tokens = session.tokens(std::string(db.text(idx)));
+    }
+    std::string header = rag_context_header(db, idx, scores[i], fused ? lexical[idx] : -1.0f);
+    int tokens = session.tokens(header) + text_tokens + separator_tokens;
+    if (!session.budget_ok(tokens)) continue; /* a shorter chunk may still fit */
 
     result_idx.push_back(idx);
-    result_scores.push_back(scores[idx]);
+    result_scores.push_back(scores[i]);
+    if (fused) {
+      result_lexical.push_back(lexical[idx]);
+    }
     session.mark(idx);
-    session.charge(db.chunks[idx].text);
+    session.charge(tokens);
   }
 
-  return rag_build_context(db, result_idx, result_scores);
+  return rag_build_context(db, result_idx, result_scores, result_lexical);
+}
+
+/* ── query cache ───────────────────────────────────────────── */
+
+/* file header for RagQueryCache, followed by n_entries of (uint64 key, float[embed_dim]) */
+struct RagQueryHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t model;
+  uint32_t embed_dim;
+  uint32_t n_entries;
+};
+
+//
+// hash of the query trimmed, lowercased and with each run of whitespace as one space
+//
+static uint64_t query_key(const std::string &query) {
+  std::string normal;
+  for (char c : query) {
+    if (isspace((unsigned char)c)) {
+      if (!normal.empty() && normal.back() != ' ') {
+        normal += ' ';
+      }
+    } else {
+      normal += (char)tolower((unsigned char)c);
+    }
+  }
+  if (!normal.empty() && normal.back() == ' ') {
+    normal.pop_back();
+  }
+  return fnv_hash(normal);
+}
+
+bool RagQueryCache::get(const std::string &query, std::vector<float> &out) {
+  if (_capacity == 0) {
+    return false;
+  }
+  auto it = _index.find(query_key(query));
+  if (it == _index.end()) {
+    _misses++;
+    return false;
+  }
+  _entries.splice(_entries.begin(), _entries, it->second);
+  out = it->second->second;
+  _hits++;
+  return true;
+}
+
+void RagQueryCache::put(const std::string &query, const std::vector<float> &embedding) {
+  if (_capacity == 0) {
+    return;
+  }
+  uint64_t key = query_key(query);
+  auto it = _index.find(key);
+  if (it != _index.end()) {
+    _entries.erase(it->second);
+  }
+  _entries.emplace_front(key, embedding);
+  _index[key] = _entries.begin();
+  resize(_capacity);
+}
+
+void RagQueryCache::resize(size_t capacity) {
+  _capacity = capacity;
+  while (_entries.size() > _capacity) {
+    _index.erase(_entries.back().first);
+    _entries.pop_back();
+  }
+}
+
+void RagQueryCache::clear() {
+  _entries.clear();
+  _index.clear();
+  _hits = 0;
+  _misses = 0;
+}
+
+bool RagQueryCache::load(const std::string &path, uint64_t model, int embed_dim) {
+  std::ifstream f(path, std::ios::binary);
+  RagQueryHeader header = {};
+  if (!f.read((char *)&header, sizeof(header)) ||
+      header.magic != QUERY_MAGIC ||
+      header.version != QUERY_VERSION ||
+      header.model != model ||
+      header.embed_dim != (uint32_t)embed_dim) {
+    return false;
+  }
+
+  clear();
+  std::vector<float> embedding(embed_dim);
+  for (uint32_t i = 0; i < header.n_entries && _entries.size() < _capacity; i++) {
+    uint64_t key;
+    if (!f.read((char *)&key, sizeof(key)) ||
+        !f.read((char *)embedding.data(), (std::streamsize)(embed_dim * sizeof(float)))) {
+      break;
+    }
+    if (!_index.count(key)) {
+      _entries.emplace_back(key, embedding);
+      _index[key] = std::prev(_entries.end());
+    }
+  }
+  return true;
+}
+
+bool RagQueryCache::save(const std::string &path, uint64_t model) const {
+  RagQueryHeader header = {};
+  header.magic = QUERY_MAGIC;
+  header.version = QUERY_VERSION;
+  header.model = model;
+  header.embed_dim = _entries.empty() ? 0 : (uint32_t)_entries.front().second.size();
+  header.n_entries = (uint32_t)_entries.size();
+
+  std::ofstream f(path, std::ios::binary | std::ios::trunc);
+  f.write((const char *)&header, sizeof(header));
+  for (const Entry &entry : _entries) {
+    f.write((const char *)&entry.first, sizeof(entry.first));
+    f.write((const char *)entry.second.data(), (std::streamsize)(entry.second.size() * sizeof(float)));
+  }
+  f.close();
+  return f.good();
 }
 
-bool RagDB::save(const std::string &path) {
-  std::ofstream f(path, std::ios::binary);
+/* ── storage ───────────────────────────────────────────────── */
+
+static uint64_t align_up(uint64_t offset) {
+  return (offset + RAG_ALIGN - 1) & ~(uint64_t)(RAG_ALIGN - 1);
+}
+
+//
+// whether len bytes at offset lie within a file of the given size, without overflowing
+//
+static bool in_file(uint64_t offset, uint64_t len, uint64_t size) {
+  return offset <= size && len <= size - offset;
+}
+
+//
+// whether every string of every entry lies within the string arena
+//
+static bool entries_valid(const RagEntry *entries, uint32_t n_chunks, uint64_t strings_size) {
+  bool result = true;
+  for (uint32_t i = 0; result && i < n_chunks; i++) {
+    const RagEntry &entry = entries[i];
+    result = (in_file(entry.text, entry.text_len, strings_size) &&
+              in_file(entry.source, entry.source_len, strings_size) &&
+              in_file(entry.type, entry.type_len, strings_size));
+  }
+  return result;
+}
+
+RagDB::~RagDB() {
+  unmap();
+}
+
+void RagDB::clear() {
+  drop_quant();
+  drop_ann();
+  drop_lexical();
+  unmap();
+  _embeddings.clear();
+  _owned_entries.clear();
+  _arena.clear();
+  _interned.clear();
+  _sources.clear();
+  _source_index.clear();
+  _tokens.clear();
+  _tokens_vocab = 0;
+  _dirty = true;
+  update();
+}
+
+void RagDB::add(const RagChunk &chunk, const float *embedding) {
+  own();
+  drop_quant();
+  drop_lexical();
+  if (!_ann.empty()) {
+    // file the chunk under the nearest existing list, the lists are rebuilt on save
+    _ann_rows.push_back(ivf_nearest(_ann, embedding));
+    _ann_stale = true;
+  }
+  RagEntry entry = {};
+  entry.source_len = (uint16_t)std::min(chunk.source.size(), (size_t)65535);
+  entry.source = intern(chunk.source, entry.source_len);
+  entry.type_len = (uint8_t)std::min(chunk.type.size(), (size_t)255);
+  entry.type = intern(chunk.type, entry.type_len);
+  entry.text_len = (uint32_t)chunk.text.size();
+  entry.text = _arena.size();
+  _arena += chunk.text;
+  _owned_entries.push_back(entry);
+  _embeddings.insert(_embeddings.end(), embedding, embedding + embed_dim);
+  if (!_tokens.empty()) {
+    _tokens.push_back(RAG_TOKENS_UNKNOWN);
+  }
+  _dirty = true;
+  update();
+}
+
+void RagDB::count_tokens(uint64_t vocab, const std::function<int(const std::string &text)> &count) {
+  if (vocab != _tokens_vocab || _tokens.size() != (size_t)_n_chunks) {
+    _tokens.assign(_n_chunks, RAG_TOKENS_UNKNOWN);
+    _tokens_vocab = vocab;
+  }
+  for (int i = 0; i < _n_chunks; i++) {
+    if (_tokens[i] == RAG_TOKENS_UNKNOWN) {
+      _tokens[i] = (uint32_t)count(std::string(text(i)));
+      _dirty = true;
+    }
+  }
+}
+
+/* ── sources ───────────────────────────────────────────────── */
+
+static uint64_t file_hash(const std::string &path) {
+  size_t size = 0;
+  void *data = map_file(path, size);
+  uint64_t result = fnv_hash(std::string_view((const char *)data, data != nullptr ? size : 0));
+  if (data != nullptr) {
+    unmap_file(data, size);
+  }
+  return result;
+}
+
+//
+// the state is read by the caller before chunking, so that an edit made while
+// indexing is seen as a change next time
+//
+//
+// src, ./src and /abs/src name the same files, so each spelling maps to one key
+//
+std::string RagDB::source_path(const std::string &path) {
+  std::error_code ec;
+  fs::path result = fs::weakly_canonical(path, ec);
+  if (ec) {
+    result = fs::absolute(path, ec).lexically_normal();
+  }
+  return ec ? path : result.string();
+}
+
+void RagDB::add_source(const std::string &file, RagSourceEntry state, int n_chunks) {
+  std::string path = source_path(file);
+  state.first = (uint32_t)(_n_chunks - n_chunks);
+  state.n_chunks = (uint32_t)n_chunks;
+  state.path_len = (uint32_t)path.size();
+  state.reserved = 0;
+  auto it = _source_index.find(path);
+  if (it != _source_index.end()) {
+    _sources[it->second].state = state;
+  } else {
+    _source_index.emplace(path, _sources.size());
+    _sources.push_back(RagSource{path, state});
+  }
+  _dirty = true;
+}
+
+bool RagDB::changed(const std::string &path) {
+  uint64_t size;
+  int64_t mtime;
+  auto it = _source_index.find(source_path(path));
+  if (it == _source_index.end() || !file_stat(path, size, mtime)) {
+    return true;
+  }
+
+  bool result;
+  RagSourceEntry &record = _sources[it->second].state;
+  if (size == record.size && mtime == record.mtime) {
+    result = false;
+  } else if (size != record.size || file_hash(path) != record.hash) {
+    result = true;
+  } else {
+    record.mtime = mtime;
+    _dirty = true;
+    result = false;
+  }
+  return result;
+}
+
+int RagDB::remove_sources(const std::function<bool(const std::string &path)> &match) {
+  std::vector<bool> drop(_n_chunks, false);
+  std::vector<bool> matched(_sources.size(), false);
+  int result = 0;
+  for (size_t i = 0; i < _sources.size(); i++) {
+    if (match(_sources[i].path)) {
+      const RagSourceEntry &state = _sources[i].state;
+      std::fill(drop.begin() + state.first, drop.begin() + state.first + state.n_chunks, true);
+      matched[i] = true;
+      result++;
+    }
+  }
+  if (result == 0) {
+    return 0;
+  }
+
+  own();
+  drop_quant();
+  drop_lexical();
+
+  // compact the rows in place and rebuild the arena without the dropped text
+  std::string arena;
+  arena.swap(_arena);
+  _interned.clear();
+  std::vector<uint32_t> kept_before(_n_chunks + 1);
+  uint32_t kept = 0;
+  for (int i = 0; i < _n_chunks; i++) {
+    kept_before[i] = kept;
+    if (drop[i]) {
+      continue;
+    }
+    RagEntry entry = _owned_entries[i];
+    entry.source = intern(arena.substr(entry.source, entry.source_len), entry.source_len);
+    entry.type = intern(arena.substr(entry.type, entry.type_len), entry.type_len);
+    entry.text = _arena.size();
+    _arena.append(arena, _owned_entries[i].text, entry.text_len);
+    _owned_entries[kept] = entry;
+    if (kept != (uint32_t)i) {
+      std::copy_n(_embeddings.begin() + (size_t)i * embed_dim, embed_dim, _embeddings.begin() + (size_t)kept * embed_dim);
+    }
+    if (!_ann.empty()) {
+      _ann_rows[kept] = _ann_rows[i];
+    }
+    if (!_tokens.empty()) {
+      _tokens[kept] = _tokens[i];
+    }
+    kept++;
+  }
+  kept_before[_n_chunks] = kept;
+  _owned_entries.resize(kept);
+  _embeddings.resize((size_t)kept * embed_dim);
+  if (!_ann.empty()) {
+    _ann_rows.resize(kept);
+    _ann_stale = true;
+  }
+  if (!_tokens.empty()) {
+    _tokens.resize(kept);
+  }
+
+  std::vector<RagSource> sources;
+  _source_index.clear();
+  for (size_t i = 0; i < _sources.size(); i++) {
+    if (!matched[i]) {
+      RagSource &source = _sources[i];
+      source.state.first = kept_before[source.state.first];
+      _source_index.emplace(source.path, sources.size());
+      sources.push_back(std::move(source));
+    }
+  }
+  _sources.swap(sources);
+  _dirty = true;
+  update();
+  return result;
+}
+
+//
+// returns the arena offset of the string, storing repeated source and type names once
+//
+uint64_t RagDB::intern(const std::string &s, size_t max_len) {
+  std::string key = s.substr(0, max_len);
+  auto it = _interned.find(key);
+  if (it != _interned.end()) {
+    return it->second;
+  }
+  uint64_t result = _arena.size();
+  _arena += key;
+  _interned.emplace(std::move(key), result);
+  return result;
+}
+
+//
+// copies a mapped index into owned storage so that chunks can be added
+//
+void RagDB::own() {
+  if (_map != nullptr) {
+    _embeddings.assign(_matrix, _matrix + (size_t)_n_chunks * embed_dim);
+    _owned_entries.assign(_entries, _entries + _n_chunks);
+    _arena.assign(_strings, _strings_size);
+    _interned.clear();
+    if (_quant != RAG_QUANT_NONE) {
+      uint64_t size = quant_size(_quant, _n_chunks, embed_dim);
+      _owned_quant.resize((size + 7) / 8);
+      memcpy(_owned_quant.data(), _quant_data, size);
+      _quant_data = (const uint8_t *)_owned_quant.data();
+    }
+    if (!_ann.empty()) {
+      const uint32_t *data = (const uint32_t *)_ann.centroids;
+      _owned_ann.assign(data, data + ivf_size(_ann.n_lists, _n_chunks, embed_dim) / sizeof(uint32_t));
+      _ann = ivf_view(_owned_ann.data(), _ann.n_lists, _ann.n_probe, embed_dim);
+      ivf_row_lists(_ann, _n_chunks, _ann_rows);
+    }
+    unmap();
+    update();
+  }
+}
+
+uint64_t RagDB::quant_rows_offset(RagQuant quant, int n_chunks) {
+  return quant == RAG_QUANT_INT8 ? align_up((uint64_t)n_chunks * sizeof(float)) : 0;
+}
+
+uint64_t RagDB::quant_size(RagQuant quant, int n_chunks, int embed_dim) {
+  uint64_t result;
+  switch (quant) {
+  case RAG_QUANT_INT8:
+    result = quant_rows_offset(quant, n_chunks) + (uint64_t)n_chunks * embed_dim;
+    break;
+  case RAG_QUANT_BINARY:
+    result = (uint64_t)n_chunks * ((embed_dim + 63) / 64) * sizeof(uint64_t);
+    break;
+  default:
+    result = 0;
+    break;
+  }
+  return result;
+}
+
+//
+// builds the quantized rows from the float matrix
+//
+void RagDB::quantize(RagQuant quant) {
+  drop_quant();
+  if (quant == RAG_QUANT_NONE) {
+    return;
+  }
+  _owned_quant.assign((quant_size(quant, _n_chunks, embed_dim) + 7) / 8, 0);
+  uint8_t *data = (uint8_t *)_owned_quant.data();
+  uint8_t *rows = data + quant_rows_offset(quant, _n_chunks);
+  for (int i = 0; i < _n_chunks; i++) {
+    if (quant == RAG_QUANT_INT8) {
+      float *scales = (float *)data;
+      scales[i] = simd_quantize_i8(embedding(i), embed_dim, (int8_t *)rows + (size_t)i * embed_dim);
+    } else {
+      int n_words = (embed_dim + 63) / 64;
+      simd_quantize_bits(embedding(i), embed_dim, (uint64_t *)rows + (size_t)i * n_words);
+    }
+  }
+  _quant_data = data;
+  _quant = quant;
+}
+
+void RagDB::drop_quant() {
+  _owned_quant.clear();
+  _quant_data = nullptr;
+  _quant = RAG_QUANT_NONE;
+}
+
+//
+// clusters the float rows into an IVF index
+//
+void RagDB::build_ann() {
+  int n_lists = ivf_lists(_n_chunks);
+  _owned_ann.assign(ivf_size(n_lists, _n_chunks, embed_dim) / sizeof(uint32_t), 0);
+  ivf_build(_matrix, _n_chunks, embed_dim, n_lists, _owned_ann.data());
+  _ann = ivf_view(_owned_ann.data(), n_lists, ivf_probe(n_lists), embed_dim);
+  ivf_row_lists(_ann, _n_chunks, _ann_rows);
+  _ann_stale = false;
+}
+
+void RagDB::drop_ann() {
+  _owned_ann.clear();
+  _ann_rows.clear();
+  _ann_stale = false;
+  _ann = IvfIndex();
+}
+
+//
+// regroups the chunks by list after chunks were added or removed, keeping the centroids
+//
+void RagDB::relist_ann() {
+  int n_lists = _ann.n_lists;
+  int n_probe = _ann.n_probe;
+  _owned_ann.resize(ivf_size(n_lists, _n_chunks, embed_dim) / sizeof(uint32_t));
+  ivf_relist(_ann_rows.data(), _n_chunks, n_lists, embed_dim, _owned_ann.data());
+  _ann = ivf_view(_owned_ann.data(), n_lists, n_probe, embed_dim);
+  _ann_stale = false;
+}
+
+//
+// indexes the chunk text for BM25 ranking
+//
+void RagDB::build_lexical() {
+  int n_terms;
+  uint32_t n_postings;
+  bm25_build(_n_chunks, [this](size_t idx) { return text((int)idx); }, _owned_lexical, n_terms, n_postings);
+  _lexical = n_terms != 0 ? bm25_view(_owned_lexical.data(), n_terms, n_postings, _n_chunks) : Bm25Index();
+}
+
+void RagDB::drop_lexical() {
+  _owned_lexical.clear();
+  _lexical = Bm25Index();
+}
+
+void RagDB::unmap() {
+  if (_map != nullptr) {
+    unmap_file(_map, _map_size);
+    _map = nullptr;
+    _map_size = 0;
+  }
+}
+
+//
+// points the views at the owned storage
+//
+void RagDB::update() {
+  _matrix = _embeddings.data();
+  _entries = _owned_entries.data();
+  _strings = _arena.data();
+  _strings_size = _arena.size();
+  _n_chunks = (int)_owned_entries.size();
+}
+
+bool RagDB::save(const std::string &path, RagQuant quant, bool ann) {
+  if (quant != _quant) {
+    quantize(quant);
+  }
+  if (!_ann.empty() && (!ann || _n_chunks < RAG_ANN_MIN ||
+                         ivf_lists(_n_chunks) > 2 * _ann.n_lists ||
+                         ivf_lists(_n_chunks) * 2 < _ann.n_lists)) {
+    // retrain once the size has drifted too far from the one the lists were trained for
+    drop_ann();
+  }
+  if (_ann.empty() && ann && _n_chunks >= RAG_ANN_MIN) {
+    build_ann();
+  } else if (_ann_stale) {
+    relist_ann();
+  }
+  if (_lexical.empty() && _n_chunks > 0) {
+    build_lexical();
+  }
+
+  RagHeader header = {};
+  header.magic = MAGIC;
+  header.version = 4;
+  header.n_chunks = (uint32_t)_n_chunks;
+  header.embed_dim = (uint32_t)embed_dim;
+  header.matrix = align_up(sizeof(RagHeader));
+  header.entries = align_up(header.matrix + (uint64_t)_n_chunks * embed_dim * sizeof(float));
+  header.strings = header.entries + (uint64_t)_n_chunks * sizeof(RagEntry);
+  header.strings_size = _strings_size;
+  header.quant = _quant;
+  uint64_t end = header.strings + _strings_size;
+  if (_quant != RAG_QUANT_NONE) {
+    header.quant_data = align_up(end);
+    end = header.quant_data + quant_size(_quant, _n_chunks, embed_dim);
+  }
+  if (!_ann.empty()) {
+    header.ann = align_up(end);
+    header.ann_lists = (uint32_t)_ann.n_lists;
+    header.ann_probe = (uint32_t)_ann.n_probe;
+    end = header.ann + ivf_size(_ann.n_lists, _n_chunks, embed_dim);
+  }
+  if (!_sources.empty()) {
+    header.sources = align_up(end);
+    header.n_sources = (uint32_t)_sources.size();
+    end = header.sources + _sources.size() * sizeof(RagSourceEntry);
+    for (const RagSource &source : _sources) {
+      end += source.path.size();
+    }
+  }
+  if (!_lexical.empty()) {
+    header.lexical = align_up(end);
+    header.lex_terms = (uint32_t)_lexical.n_terms;
+    header.lex_postings = _lexical.n_postings;
+    end = header.lexical + bm25_size(_lexical.n_terms, _lexical.n_postings, _n_chunks);
+  }
+  if (!_tokens.empty()) {
+    header.tokens = align_up(end);
+    header.tokens_vocab = _tokens_vocab;
+  }
+
+  // write beside the target then rename, so a process still mapping the old file is unaffected
+  std::string tmp_path = path + ".tmp";
+  std::ofstream f(tmp_path, std::ios::binary | std::ios::trunc);
   if (!f) {
     return false;
   }
 
-  auto write32 = [&](uint32_t v) { f.write((char*)&v, 4); };
-  auto write16 = [&](uint16_t v) { f.write((char*)&v, 2); };
-  auto write8  = [&](uint8_t  v) { f.write((char*)&v, 1); };
-  auto writestr = [&](const std::string &s, size_t max_len) {
-    size_t len = std::min(s.size(), max_len);
-    f.write(s.c_str(), (std::streamsize)len);
+  uint64_t pos = 0;
+  auto write = [&](const void *data, uint64_t len) {
+    f.write((const char *)data, (std::streamsize)len);
+    pos += len;
+  };
+  auto pad = [&](uint64_t offset) {
+    static const char zeros[RAG_ALIGN] = {};
+    write(zeros, offset - pos);
   };
 
-  write32(MAGIC);              /* magic "RAGD" */
-  write32(2);                       /* version      */
-  write32((uint32_t)chunks.size()); /* n_chunks     */
-  write32((uint32_t)embed_dim);     /* embed_dim    */
+  write(&header, sizeof(header));
+  pad(header.matrix);
+  write(_matrix, (uint64_t)_n_chunks * embed_dim * sizeof(float));
+  pad(header.entries);
+  write(_entries, (uint64_t)_n_chunks * sizeof(RagEntry));
+  write(_strings, _strings_size);
+  if (_quant != RAG_QUANT_NONE) {
+    pad(header.quant_data);
+    write(_quant_data, quant_size(_quant, _n_chunks, embed_dim));
+  }
+  if (!_ann.empty()) {
+    pad(header.ann);
+    write(_ann.centroids, ivf_size(_ann.n_lists, _n_chunks, embed_dim));
+  }
+  if (!_sources.empty()) {
+    pad(header.sources);
+    for (const RagSource &source : _sources) {
+      write(&source.state, sizeof(RagSourceEntry));
+    }
+    for (const RagSource &source : _sources) {
+      write(source.path.data(), source.path.size());
+    }
+  }
+  if (!_lexical.empty()) {
+    pad(header.lexical);
+    write(_lexical.terms - 1, bm25_size(_lexical.n_terms, _lexical.n_postings, _n_chunks));
+  }
+  if (!_tokens.empty()) {
+    pad(header.tokens);
+    write(_tokens.data(), _tokens.size() * sizeof(uint32_t));
+  }
+  f.close();
 
-  for (const RagChunk &c : chunks) {
-    write32((uint32_t)c.text.size());
-    f.write(c.text.c_str(), (std::streamsize)c.text.size());
+  std::error_code ec;
+  if (!f.good()) {
+    fs::remove(tmp_path, ec);
+    return false;
+  }
+  fs::rename(tmp_path, path, ec);
+  if (!ec) {
+    _dirty = false;
+  }
+  return !ec;
+}
 
-    uint16_t src_len = (uint16_t)std::min(c.source.size(), (size_t)65535);
-    write16(src_len);
-    writestr(c.source, src_len);
+bool RagDB::load(const std::string &path) {
+  size_t size = 0;
+  void *data = map_file(path, size);
+  if (data == nullptr) {
+    return false;
+  }
 
-    uint8_t type_len = (uint8_t)std::min(c.type.size(), (size_t)255);
-    write8(type_len);
-    writestr(c.type, type_len);
+  uint32_t magic_version[2] = {};
+  memcpy(magic_version, data, std::min(size, sizeof(magic_version)));
+  if (size < 16 || magic_version[0] != MAGIC) {
+    unmap_file(data, size);
+    return false;
+  }
+  if (magic_version[1] == 2) {
+    unmap_file(data, size);
+    return load_v2(path);
+  }
 
-    f.write((char*)c.embedding.data(),
-            (std::streamsize)(embed_dim * sizeof(float)));
+  // version 3 headers are the first 64 bytes, the IVF fields then read as zero
+  RagHeader header = {};
+  size_t header_size = magic_version[1] == 3 ? RAG_HEADER_V3 : sizeof(RagHeader);
+  memcpy(&header, data, std::min(size, header_size));
+
+  uint64_t matrix_size = (uint64_t)header.n_chunks * header.embed_dim * sizeof(float);
+  uint64_t entries_size = (uint64_t)header.n_chunks * sizeof(RagEntry);
+  RagQuant quant = (RagQuant)header.quant;
+  uint64_t quant_bytes = quant_size(quant, header.n_chunks, header.embed_dim);
+  uint64_t ann_bytes = ivf_size(header.ann_lists, header.n_chunks, header.embed_dim);
+  uint64_t lexical_bytes = bm25_size(header.lex_terms, header.lex_postings, header.n_chunks);
+
+  // the source table is followed by the paths, whose total length is known once it is read
+  const RagSourceEntry *sources = (const RagSourceEntry *)((const char *)data + header.sources);
+  uint64_t sources_size = (uint64_t)header.n_sources * sizeof(RagSourceEntry);
+  bool sources_ok = header.n_sources == 0 || (header.sources % RAG_ALIGN == 0 &&
+                                              in_file(header.sources, sources_size, size));
+  uint64_t sources_end = header.sources + sources_size;
+  for (uint32_t i = 0; sources_ok && i < header.n_sources; i++) {
+    sources_end += sources[i].path_len;
+    sources_ok = ((uint64_t)sources[i].first + sources[i].n_chunks <= header.n_chunks &&
+                  sources_end <= size);
+  }
+  bool valid = !((header.version != 3 && header.version != 4) ||
+                 quant > RAG_QUANT_BINARY ||
+                 (quant != RAG_QUANT_NONE && (header.quant_data % RAG_ALIGN != 0 ||
+                                              !in_file(header.quant_data, quant_bytes, size))) ||
+                 (header.ann_lists != 0 && (header.ann % RAG_ALIGN != 0 ||
+                                            header.ann_lists > header.n_chunks ||
+                                            header.ann_probe == 0 ||
+                                            header.ann_probe > header.ann_lists ||
+                                            !in_file(header.ann, ann_bytes, size))) ||
+                 !sources_ok ||
+                 (header.lex_terms != 0 && (header.lexical % RAG_ALIGN != 0 ||
+                                            header.lex_terms > header.lex_postings ||
+                                            !in_file(header.lexical, lexical_bytes, size))) ||
+                 (header.tokens != 0 && (header.tokens % RAG_ALIGN != 0 ||
+                                         !in_file(header.tokens, (uint64_t)header.n_chunks * sizeof(uint32_t), size))) ||
+                 size < header_size ||
+                 header.matrix % sizeof(float) != 0 ||
+                 header.entries % alignof(RagEntry) != 0 ||
+                 !in_file(header.matrix, matrix_size, size) ||
+                 !in_file(header.entries, entries_size, size) ||
+                 !in_file(header.strings, header.strings_size, size));
+
+  // the tables are read without further checks, so their contents are bounds checked once here
+  IvfIndex ann;
+  Bm25Index lexical;
+  if (valid) {
+    const RagEntry *entries = (const RagEntry *)((const char *)data + header.entries);
+    valid = entries_valid(entries, header.n_chunks, header.strings_size);
+  }
+  if (valid && header.ann_lists != 0) {
+    ann = ivf_view((const char *)data + header.ann, header.ann_lists, header.ann_probe, header.embed_dim);
+    valid = ivf_valid(ann, header.n_chunks);
+  }
+  if (valid && header.lex_terms != 0) {
+    lexical = bm25_view((const char *)data + header.lexical, header.lex_terms, header.lex_postings, header.n_chunks);
+    valid = bm25_valid(lexical);
+  }
+  if (!valid) {
+    unmap_file(data, size);
+    return false;
   }
 
-  return f.good();
+  clear();
+  _map = data;
+  _map_size = size;
+  embed_dim = (int)header.embed_dim;
+  _n_chunks = (int)header.n_chunks;
+  _matrix = (const float *)((const char *)data + header.matrix);
+  _entries = (const RagEntry *)((const char *)data + header.entries);
+  _strings = (const char *)data + header.strings;
+  _strings_size = header.strings_size;
+  if (quant != RAG_QUANT_NONE) {
+    _quant = quant;
+    _quant_data = (const uint8_t *)data + header.quant_data;
+  }
+  if (!ann.empty() && _n_chunks >= RAG_ANN_MIN) {
+    _ann = ann;
+  }
+  _lexical = lexical;
+  if (header.tokens != 0) {
+    const uint32_t *tokens = (const uint32_t *)((const char *)data + header.tokens);
+    _tokens.assign(tokens, tokens + _n_chunks);
+    _tokens_vocab = header.tokens_vocab;
+  }
+  const char *paths = (const char *)(sources + header.n_sources);
+  for (uint32_t i = 0; i < header.n_sources; i++) {
+    RagSource source{std::string(paths, sources[i].path_len), sources[i]};
+    paths += sources[i].path_len;
+    _source_index.emplace(source.path, _sources.size());
+    _sources.push_back(std::move(source));
+  }
+  _dirty = false;
+  return true;
 }
 
-bool RagDB::load(const std::string &path) {
+//
+// reads the version 2 format into owned storage
+//
+bool RagDB::load_v2(const std::string &path) {
   std::ifstream f(path, std::ios::binary);
   if (!f) {
     return false;
@@ -422,11 +1510,12 @@ bool RagDB::load(const std::string &path) {
     return false;
   }
 
+  clear();
   embed_dim = (int)edim;
-  chunks.resize(n);
+  std::vector<float> embedding(edim);
 
-  for (uint32_t i = 0; i < n; i++) {
-    RagChunk &c = chunks[i];
+  for (uint32_t i = 0; i < n && f; i++) {
+    RagChunk c;
 
     uint32_t text_len = read32();
     c.text = readstr(text_len);
@@ -437,9 +1526,10 @@ bool RagDB::load(const std::string &path) {
     uint8_t type_len = read8();
     c.type = readstr(type_len);
 
-    c.embedding.resize(edim);
-    f.read((char*)c.embedding.data(), (std::streamsize)(edim * sizeof(float)));
+    f.read((char*)embedding.data(), (std::streamsize)(edim * sizeof(float)));
+    add(c, embedding.data());
   }
 
+  _dirty = false;
   return true;
 }
@@ -7,39 +7,312 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "llama-sb-bm25.h"
+#include "llama-sb-ivf.h"
+
 struct RagChunk {
   std::string        text;
   std::string        source;
   std::string        type;
-  std::vector<float> embedding;
 };
 
-/* ── on-disk chunk (variable-length text) ──────────────────── */
+/* ── on-disk format, version 4 ─────────────────────────────── */
 /*
- * db header  (16 bytes):
+ * db header  (128 bytes):
  *   uint32  magic      = 0x52414744  "RAGD"
- *   uint32  version    = 2
+ *   uint32  version    = 4
  *   uint32  n_chunks
  *   uint32  embed_dim
+ *   uint64  matrix         file offset of the embeddings, RAG_ALIGN aligned
+ *   uint64  entries        file offset of the RagEntry table
+ *   uint64  strings        file offset of the string arena
+ *   uint64  strings_size
+ *   uint32  quant          RagQuant of the quantized section
+ *   uint32  reserved       zero
+ *   uint64  quant_data     file offset of the quantized section, zero when none
+ *   uint64  ann            file offset of the IVF section, zero when none
+ *   uint32  ann_lists      number of IVF lists
+ *   uint32  ann_probe      suggested lists probed per query
+ *   uint64  sources        file offset of the RagSourceEntry table, zero when none
+ *   uint32  n_sources
+ *   uint32  reserved3      zero
+ *   uint64  lexical        file offset of the BM25 section, zero when none
+ *   uint32  lex_terms      distinct terms in the BM25 section
+ *   uint32  lex_postings   (term, chunk) pairs in the BM25 section
+ *   uint64  tokens         file offset of the token counts, zero when none
+ *   uint64  tokens_vocab   Llama::vocab_hash() of the vocabulary they were counted with
+ *
+ * float[n_chunks][embed_dim]  matrix
+ * RagEntry[n_chunks]          entries
+ * char[strings_size]          strings, source and type names are shared
+ *
+ * quantized section, RAG_ALIGN aligned:
+ *   int8:    float[n_chunks] scales, then int8[n_chunks][embed_dim] at the next RAG_ALIGN boundary
+ *   binary:  uint64[n_chunks][(embed_dim + 63) / 64] sign bits
+ *
+ * IVF section, RAG_ALIGN aligned, optionally written for indexes of RAG_ANN_MIN chunks or more:
+ *   float[ann_lists][embed_dim]  centroids
+ *   uint32[ann_lists + 1]        list offsets into ids
+ *   uint32[n_chunks]             chunk numbers grouped by list
+ *
+ * sources section, RAG_ALIGN aligned:
+ *   RagSourceEntry[n_sources], then the paths of each entry without separators
+ *
+ * BM25 section, RAG_ALIGN aligned:
+ *   uint64[1]                    total tokens over all chunks
+ *   uint64[lex_terms]            term hashes, ascending
+ *   uint32[lex_terms + 1]        term offsets into the postings
+ *   uint32[lex_postings]         chunk numbers, grouped by term
+ *   uint32[lex_postings]         occurrences of the term in the chunk
+ *   uint32[n_chunks]             tokens in each chunk
+ *
+ * token counts, RAG_ALIGN aligned:
+ *   uint32[n_chunks]  generation model tokens in each chunk text, RAG_TOKENS_UNKNOWN when not counted
  *
- * per chunk:
- *   uint32  text_len
- *   char[]  text          (text_len bytes, no null)
- *   uint16  source_len
- *   char[]  source        (source_len bytes, no null)
- *   uint8   type_len
- *   char[]  type          (type_len bytes, no null)
- *   float[] embedding     (embed_dim floats)
+ * Retrieval scans the quantized rows then rescores the best candidates with the
+ * float rows, so only a few float pages of a mapped index are ever touched.
+ * With an IVF section only the chunks filed under the nearest lists are scored.
+ * The BM25 section lets fused retrieval also rank exact identifier matches.
+ *
+ * The file is mapped as is, so opening an index needs no parsing and the
+ * pages are shared by every process using it. Version 3 files (the first
+ * 64 bytes of this header) and version 2 files (a 16 byte header then per
+ * chunk text, source, type and embedding) are still read.
  */
+#define RAG_ALIGN 64
+#define RAG_HEADER_V3 64
+
+/* smaller indexes are always scanned exactly, below this the exact scan takes a few ms at most */
+#define RAG_ANN_MIN 32768
+
+/* token count of a chunk added since the counts were taken */
+#define RAG_TOKENS_UNKNOWN 0xffffffffu
+
+/* how rag_retrieve ranks the chunks */
+enum RagRank {
+  RAG_RANK_VECTOR = 0,      /* cosine similarity only                            */
+  RAG_RANK_FUSED = 1        /* reciprocal rank fusion of cosine and BM25 ranks   */
+};
+
+enum RagQuant {
+  RAG_QUANT_NONE = 0,
+  RAG_QUANT_INT8 = 1,
+  RAG_QUANT_BINARY = 2
+};
+
+struct RagHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t n_chunks;
+  uint32_t embed_dim;
+  uint64_t matrix;
+  uint64_t entries;
+  uint64_t strings;
+  uint64_t strings_size;
+  uint32_t quant;
+  uint32_t reserved;
+  uint64_t quant_data;
+  uint64_t ann;
+  uint32_t ann_lists;
+  uint32_t ann_probe;
+  uint64_t sources;
+  uint32_t n_sources;
+  uint32_t reserved3;
+  uint64_t lexical;
+  uint32_t lex_terms;
+  uint32_t lex_postings;
+  uint64_t tokens;
+  uint64_t tokens_vocab;
+};
+
+/* string arena offsets for one chunk (32 bytes) */
+struct RagEntry {
+  uint64_t text;
+  uint64_t source;
+  uint64_t type;
+  uint32_t text_len;
+  uint16_t source_len;
+  uint8_t  type_len;
+  uint8_t  reserved;
+};
+
+/* state of an indexed file and the range of its chunks (40 bytes) */
+struct RagSourceEntry {
+  uint64_t size;
+  int64_t  mtime;        /* last write time in file clock ticks */
+  uint64_t hash;         /* FNV-1a of the content */
+  uint32_t first;
+  uint32_t n_chunks;
+  uint32_t path_len;
+  uint32_t reserved;
+};
+
+struct RagSource {
+  std::string    path;
+  RagSourceEntry state;
+};
+
 struct RagDB {
-  std::vector<RagChunk> chunks;
+  RagDB() = default;
+  ~RagDB();
+
+  RagDB(const RagDB &) = delete;
+  RagDB &operator=(const RagDB &) = delete;
+
   int embed_dim = 0;
 
   bool load(const std::string &path);
-  bool save(const std::string &path);
+  /* ann adds an IVF index when there are RAG_ANN_MIN chunks or more */
+  bool save(const std::string &path, RagQuant quant = RAG_QUANT_NONE, bool ann = false);
+
+  /* appends a chunk, embedding holds embed_dim floats */
+  void add(const RagChunk &chunk, const float *embedding);
+  void clear();
+
+  /* the absolute, normalised form of path that sources are recorded under */
+  static std::string source_path(const std::string &path);
+
+  /* records path, in the given state, as the source of the last n_chunks added chunks */
+  void add_source(const std::string &path, RagSourceEntry state, int n_chunks);
+
+  /*
+   * true when the file is new or its content differs from the recorded source.
+   * a file touched without changing has its recorded mtime refreshed instead
+   */
+  bool changed(const std::string &path);
+
+  /* drops the matching sources and their chunks, returns the number dropped */
+  int remove_sources(const std::function<bool(const std::string &path)> &match);
+
+  const std::vector<RagSource> &sources() const { return _sources; }
 
-  int  size()  const { return (int)chunks.size(); }
-  bool empty() const { return chunks.empty(); }
+  /* true when modified since the last load() or save() */
+  bool dirty() const { return _dirty; }
+
+  int  size()  const { return _n_chunks; }
+  bool empty() const { return _n_chunks == 0; }
+
+  /* n_chunks x embed_dim, row i is the embedding of chunk i */
+  const float *matrix() const { return _matrix; }
+  const float *embedding(int idx) const { return _matrix + (size_t)idx * embed_dim; }
+
+  std::string_view text(int idx) const   { return str(_entries[idx].text, _entries[idx].text_len); }
+  std::string_view source(int idx) const { return str(_entries[idx].source, _entries[idx].source_len); }
+  std::string_view type(int idx) const   { return str(_entries[idx].type, _entries[idx].type_len); }
+
+  /* quantized rows, available after save() or load() of a quantized index */
+  RagQuant quant() const { return _quant; }
+  const float *quant_scales() const { return (const float *)_quant_data; }
+  const int8_t *quant_i8() const { return (const int8_t *)(_quant_data + quant_rows_offset(_quant, _n_chunks)); }
+  const uint64_t *quant_bits() const { return (const uint64_t *)(_quant_data + quant_rows_offset(_quant, _n_chunks)); }
+
+  /* IVF index, available after save() or load() of an index saved with one */
+  IvfIndex ann() const { return _ann_stale ? IvfIndex() : _ann; }
+
+  /* BM25 index, available after save() or load() of an index saved with one */
+  const Bm25Index &lexical() const { return _lexical; }
+
+  /* counts the tokens of each chunk not yet counted with the vocabulary */
+  void count_tokens(uint64_t vocab, const std::function<int(const std::string &text)> &count);
+
+  /* tokens in the chunk text when counted with the vocabulary, otherwise -1 */
+  int tokens(int idx, uint64_t vocab) const {
+    return vocab == _tokens_vocab && idx < (int)_tokens.size() && _tokens[idx] != RAG_TOKENS_UNKNOWN ?
+      (int)_tokens[idx] : -1;
+  }
+
+  private:
+  static uint64_t quant_rows_offset(RagQuant quant, int n_chunks);
+  static uint64_t quant_size(RagQuant quant, int n_chunks, int embed_dim);
+  void quantize(RagQuant quant);
+  void drop_quant();
+  void build_ann();
+  void drop_ann();
+  void relist_ann();
+  void build_lexical();
+  void drop_lexical();
+  std::string_view str(uint64_t offset, size_t len) const { return std::string_view(_strings + offset, len); }
+  uint64_t intern(const std::string &s, size_t max_len);
+  bool load_v2(const std::string &path);
+  void own();
+  void unmap();
+  void update();
+
+  /* views over either the owned storage or the mapped file */
+  const float    *_matrix = nullptr;
+  const RagEntry *_entries = nullptr;
+  const char     *_strings = nullptr;
+  uint64_t        _strings_size = 0;
+  const uint8_t  *_quant_data = nullptr;
+  RagQuant        _quant = RAG_QUANT_NONE;
+  IvfIndex        _ann;
+  Bm25Index       _lexical;
+  int             _n_chunks = 0;
+
+  /* owned storage, used while indexing and for version 2 files */
+  std::vector<float>    _embeddings;
+  std::vector<RagEntry> _owned_entries;
+  std::string           _arena;
+  std::unordered_map<std::string, uint64_t> _interned;
+  std::vector<uint64_t> _owned_quant;
+  std::vector<uint32_t> _owned_ann;
+  std::vector<uint64_t> _owned_lexical;
+
+  /* token counts are copied on load, so they can be filled in without owning the index */
+  std::vector<uint32_t> _tokens;
+  uint64_t              _tokens_vocab = 0;
+
+  /* the IVF list of each chunk, kept while chunks are added or removed */
+  std::vector<uint32_t> _ann_rows;
+  bool                  _ann_stale = false;
+
+  std::vector<RagSource> _sources;
+  std::unordered_map<std::string, size_t> _source_index;
+  bool                   _dirty = false;
+
+  void  *_map = nullptr;
+  size_t _map_size = 0;
+};
+
+//
+// least recently used query embeddings, keyed by a hash of the query with case and
+// whitespace normalized, so that repeated questions are not embedded again
+//
+struct RagQueryCache {
+  /* copies the cached embedding of the query into out, counting a hit or a miss */
+  bool get(const std::string &query, std::vector<float> &out);
+  void put(const std::string &query, const std::vector<float> &embedding);
+
+  /* capacity zero disables the cache, dropping the least recently used entries as needed */
+  void resize(size_t capacity);
+  void clear();
+
+  /* the file holds the entries of one embedding model, identified by model and embed_dim */
+  bool load(const std::string &path, uint64_t model, int embed_dim);
+  bool save(const std::string &path, uint64_t model) const;
+
+  size_t   capacity() const { return _capacity; }
+  size_t   size() const     { return _entries.size(); }
+  uint64_t hits() const     { return _hits; }
+  uint64_t misses() const   { return _misses; }
+
+  private:
+  using Entry = std::pair<uint64_t, std::vector<float>>;
+
+  std::list<Entry> _entries;     /* most recently used first */
+  std::unordered_map<uint64_t, std::list<Entry>::iterator> _index;
+  size_t   _capacity = 256;
+  uint64_t _hits = 0;
+  uint64_t _misses = 0;
 };
 
 //
@@ -48,13 +321,28 @@ struct RagDB {
 struct RagSession {
   std::vector<bool> seen;        /* sized to db.size() on init  */
   int  tokens_used  = 0;
-  int  tokens_max   = 0;         /* set to your n_ctx           */
+  int  tokens_max   = 0;         /* token limit, 0 for none     */
   float score_threshold = 0.60f; /* skip weak matches           */
+  float lexical_threshold = 3.0f; /* BM25 score that admits a weak match when fused */
+  RagRank rank = RAG_RANK_FUSED;
+  int probe = 0;                 /* IVF lists probed, 0 scans exactly */
+  RagQueryCache queries;         /* kept across init and reset  */
+
+  /* the generation model's vocabulary, to use the token counts stored with the index */
+  uint64_t vocab = 0;
+  std::function<int(const std::string &text)> count_tokens;
 
+  /* allows 85% of the context for retrieved chunks over the session */
   void init(int n_chunks, int ctx_size) {
     seen.assign(n_chunks, false);
     tokens_used = 0;
-    tokens_max  = ctx_size;
+    tokens_max  = (int)(ctx_size * 0.85f);
+  }
+
+  /* limits the next retrieval to the free space of the live KV cache */
+  void set_headroom(int tokens) {
+    tokens_used = 0;
+    tokens_max  = std::max(tokens, 1);
   }
 
   void reset() {
@@ -65,14 +353,17 @@ struct RagSession {
   bool is_seen(int idx)  const { return idx < (int)seen.size() && seen[idx]; }
   void mark(int idx)           { if (idx < (int)seen.size()) seen[idx] = true; }
 
-  /* rough token estimate: 1 token ≈ 4 chars */
-  bool budget_ok(const std::string &text) const {
-    return tokens_max == 0 ||
-           (tokens_used + (int)text.size() / 4) < (int)(tokens_max * 0.85f);
+  /* exact with count_tokens, otherwise the rough estimate of 1 token ≈ 4 chars */
+  int tokens(const std::string &text) const {
+    return count_tokens ? count_tokens(text) : (int)text.size() / 4;
+  }
+
+  bool budget_ok(int tokens) const {
+    return tokens_max == 0 || tokens_used + tokens <= tokens_max;
   }
 
-  void charge(const std::string &text) {
-    tokens_used += (int)text.size() / 4;
+  void charge(int tokens) {
+    tokens_used += tokens;
   }
 };
 
@@ -0,0 +1,263 @@
+// This file is part of SmallBASIC
+//
+// Vector scoring kernels for RAG retrieval
+//
+// The AVX2 kernel is compiled with a target attribute and chosen at runtime,
+// so the plugin runs on older x86 CPUs without needing -mavx2 for the whole
+// build. AArch64 always has NEON.
+//
+// This program is distributed under the terms of the GPL v2.0 or later
+// Download the GNU Public License (GPL) from www.gnu.org
+//
+// Copyright(C) 2026 Chris Warren-Smith
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+#include "llama-sb-simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+ #include <immintrin.h>
+ #define SIMD_AVX2
+#elif defined(__aarch64__)
+ #include <arm_neon.h>
+ #define SIMD_NEON
+#endif
+
+typedef float (*DotFunc)(const float *a, const float *b, int n);
+typedef int32_t (*DotI8Func)(const int8_t *a, const int8_t *b, int n);
+typedef int (*HammingFunc)(const uint64_t *a, const uint64_t *b, int n_words);
+
+float simd_dot_scalar(const float *a, const float *b, int n) {
+  // independent accumulators let the compiler pipeline the multiply-adds
+  float sum0 = 0.0f;
+  float sum1 = 0.0f;
+  float sum2 = 0.0f;
+  float sum3 = 0.0f;
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    sum0 += a[i] * b[i];
+    sum1 += a[i + 1] * b[i + 1];
+    sum2 += a[i + 2] * b[i + 2];
+    sum3 += a[i + 3] * b[i + 3];
+  }
+  float result = (sum0 + sum1) + (sum2 + sum3);
+  for (; i < n; i++) {
+    result += a[i] * b[i];
+  }
+  return result;
+}
+
+static int32_t dot_i8_scalar(const int8_t *a, const int8_t *b, int n) {
+  int32_t result = 0;
+  for (int i = 0; i < n; i++) {
+    result += (int32_t)a[i] * b[i];
+  }
+  return result;
+}
+
+static int hamming_scalar(const uint64_t *a, const uint64_t *b, int n_words) {
+  int result = 0;
+  for (int i = 0; i < n_words; i++) {
+    result += __builtin_popcountll(a[i] ^ b[i]);
+  }
+  return result;
+}
+
+#if defined(SIMD_AVX2)
+__attribute__((target("avx2,fma")))
+static float dot_avx2(const float *a, const float *b, int n) {
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+  }
+  for (; i + 8 <= n; i += 8) {
+    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+  }
+  __m256 acc = _mm256_add_ps(acc0, acc1);
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+  float result = _mm_cvtss_f32(sum);
+  for (; i < n; i++) {
+    result += a[i] * b[i];
+  }
+  return result;
+}
+#endif
+
+#if defined(SIMD_AVX2)
+__attribute__((target("avx2")))
+static int32_t dot_i8_avx2(const int8_t *a, const int8_t *b, int n) {
+  // widen to int16 then multiply-add adjacent pairs into int32 lanes
+  __m256i acc = _mm256_setzero_si256();
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256i va = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(a + i)));
+    __m256i vb = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(b + i)));
+    acc = _mm256_add_epi32(acc, _mm256_madd_epi16(va, vb));
+  }
+  __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+  int32_t result = _mm_cvtsi128_si32(sum);
+  for (; i < n; i++) {
+    result += (int32_t)a[i] * b[i];
+  }
+  return result;
+}
+
+__attribute__((target("popcnt")))
+static int hamming_popcnt(const uint64_t *a, const uint64_t *b, int n_words) {
+  int result = 0;
+  for (int i = 0; i < n_words; i++) {
+    result += __builtin_popcountll(a[i] ^ b[i]);
+  }
+  return result;
+}
+#endif
+
+#if defined(SIMD_NEON)
+static int32_t dot_i8_neon(const int8_t *a, const int8_t *b, int n) {
+  int32x4_t acc = vdupq_n_s32(0);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    int8x16_t va = vld1q_s8(a + i);
+    int8x16_t vb = vld1q_s8(b + i);
+    acc = vpadalq_s16(acc, vmull_s8(vget_low_s8(va), vget_low_s8(vb)));
+    acc = vpadalq_s16(acc, vmull_high_s8(va, vb));
+  }
+  int32_t result = vaddvq_s32(acc);
+  for (; i < n; i++) {
+    result += (int32_t)a[i] * b[i];
+  }
+  return result;
+}
+
+static float dot_neon(const float *a, const float *b, int n) {
+  float32x4_t acc0 = vdupq_n_f32(0.0f);
+  float32x4_t acc1 = vdupq_n_f32(0.0f);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+    acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+  }
+  float result = vaddvq_f32(vaddq_f32(acc0, acc1));
+  for (; i < n; i++) {
+    result += a[i] * b[i];
+  }
+  return result;
+}
+#endif
+
+struct DotKernel {
+  DotKernel() :
+    _func(simd_dot_scalar),
+    _dot_i8(dot_i8_scalar),
+    _hamming(hamming_scalar),
+    _name("scalar") {
+#if defined(SIMD_AVX2)
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+      _func = dot_avx2;
+      _dot_i8 = dot_i8_avx2;
+      _name = "avx2";
+    }
+    if (__builtin_cpu_supports("popcnt")) {
+      _hamming = hamming_popcnt;
+    }
+#elif defined(SIMD_NEON)
+    _func = dot_neon;
+    _dot_i8 = dot_i8_neon;
+    _name = "neon";
+#endif
+  }
+
+  DotFunc _func;
+  DotI8Func _dot_i8;
+  HammingFunc _hamming;
+  const char *_name;
+};
+
+static const DotKernel &kernel() {
+  static DotKernel instance;
+  return instance;
+}
+
+float simd_dot(const float *a, const float *b, int n) {
+  return kernel()._func(a, b, n);
+}
+
+void simd_dot_rows(const float *matrix, size_t n_rows, int dim, const float *query, float *scores) {
+  DotFunc dot = kernel()._func;
+  for (size_t i = 0; i < n_rows; i++) {
+    scores[i] = dot(matrix + i * dim, query, dim);
+  }
+}
+
+int32_t simd_dot_i8(const int8_t *a, const int8_t *b, int n) {
+  return kernel()._dot_i8(a, b, n);
+}
+
+int simd_hamming(const uint64_t *a, const uint64_t *b, int n_words) {
+  return kernel()._hamming(a, b, n_words);
+}
+
+void simd_dot_rows_i8(const int8_t *matrix, const float *scales, size_t n_rows, int dim,
+                      const int8_t *query, float query_scale, float *scores) {
+  DotI8Func dot = kernel()._dot_i8;
+  for (size_t i = 0; i < n_rows; i++) {
+    scores[i] = dot(matrix + i * dim, query, dim) * scales[i] * query_scale;
+  }
+}
+
+void simd_hamming_rows(const uint64_t *bits, size_t n_rows, int dim, const uint64_t *query, float *scores) {
+  HammingFunc hamming = kernel()._hamming;
+  int n_words = (dim + 63) / 64;
+  float scale = dim > 0 ? 2.0f / dim : 0.0f;
+  for (size_t i = 0; i < n_rows; i++) {
+    scores[i] = 1.0f - hamming(bits + i * n_words, query, n_words) * scale;
+  }
+}
+
+float simd_quantize_i8(const float *v, int dim, int8_t *out) {
+  float max_abs = 0.0f;
+  for (int i = 0; i < dim; i++) {
+    max_abs = std::max(max_abs, std::fabs(v[i]));
+  }
+  float scale = max_abs / 127.0f;
+  float inverse = max_abs > 0.0f ? 127.0f / max_abs : 0.0f;
+  for (int i = 0; i < dim; i++) {
+    out[i] = (int8_t)std::lrint(v[i] * inverse);
+  }
+  return scale;
+}
+
+void simd_quantize_bits(const float *v, int dim, uint64_t *out) {
+  int n_words = (dim + 63) / 64;
+  std::fill(out, out + n_words, 0);
+  for (int i = 0; i < dim; i++) {
+    if (v[i] > 0.0f) {
+      out[i / 64] |= (uint64_t)1 << (i % 64);
+    }
+  }
+}
+
+void simd_top_k(const float *scores, int n, int k, std::vector<int> &out) {
+  out.resize(n);
+  std::iota(out.begin(), out.end(), 0);
+  auto by_score = [scores](int a, int b) { return scores[a] > scores[b]; };
+  if (k >= 0 && k < n) {
+    // O(n) selection, then order only the k survivors
+    std::nth_element(out.begin(), out.begin() + k, out.end(), by_score);
+    out.resize(k);
+  }
+  std::sort(out.begin(), out.end(), by_score);
+}
+
+const char *simd_name() {
+  return kernel()._name;
+}
@@ -0,0 +1,70 @@
+// This file is part of SmallBASIC
+//
+// Vector scoring kernels for RAG retrieval
+//
+// This program is distributed under the terms of the GPL v2.0 or later
+// Download the GNU Public License (GPL) from www.gnu.org
+//
+// Copyright(C) 2026 Chris Warren-Smith
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//
+// dot product using the widest kernel supported by the running CPU
+//
+float simd_dot(const float *a, const float *b, int n);
+
+//
+// portable reference implementation of simd_dot
+//
+float simd_dot_scalar(const float *a, const float *b, int n);
+
+//
+// scores[i] = dot(matrix row i, query) for a row-major n_rows x dim matrix
+//
+void simd_dot_rows(const float *matrix, size_t n_rows, int dim, const float *query, float *scores);
+
+//
+// integer dot product of int8 vectors
+//
+int32_t simd_dot_i8(const int8_t *a, const int8_t *b, int n);
+
+//
+// number of differing bits between packed bit vectors of n_words 64 bit words
+//
+int simd_hamming(const uint64_t *a, const uint64_t *b, int n_words);
+
+//
+// approximate cosine scores against int8 rows, each row scaled by scales[i]
+//
+void simd_dot_rows_i8(const int8_t *matrix, const float *scales, size_t n_rows, int dim,
+                      const int8_t *query, float query_scale, float *scores);
+
+//
+// approximate cosine scores against sign bit rows, 1 - 2 * hamming / dim
+//
+void simd_hamming_rows(const uint64_t *bits, size_t n_rows, int dim, const uint64_t *query, float *scores);
+
+//
+// symmetric int8 quantization of v, returns the scale restoring the original values
+//
+float simd_quantize_i8(const float *v, int dim, int8_t *out);
+
+//
+// packs the sign bits of v into (dim + 63) / 64 words
+//
+void simd_quantize_bits(const float *v, int dim, uint64_t *out);
+
+//
+// the indices of the k highest scores, best first
+//
+void simd_top_k(const float *scores, int n, int k, std::vector<int> &out);
+
+//
+// name of the kernel selected by simd_dot, for diagnostics
+//
+const char *simd_name();
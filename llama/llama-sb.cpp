@@ -7,7 +7,12 @@
 
 #include <format>
 #include <span>
+#include <algorithm>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <thread>
 #include <utility>
 #include "ggml-cuda.h"
 
@@ -16,6 +21,61 @@
 
 constexpr int MAX_REPEAT = 50;
 
+// embedding contexts pack several texts into one batch as distinct sequences
+constexpr int EMBED_CTX = 4096;
+constexpr int EMBED_SEQ_MAX = 32;
+constexpr int EMBED_MAX_TOKENS = 512;
+constexpr uint32_t STATE_VERSION = 1;
+
+// the llama whose generation thread is running on this thread, it receives the log errors
+static thread_local Llama *log_target = nullptr;
+
+// bytes of generated text buffered between the generation thread and the caller, and the
+// wait before the generation thread retries when the caller has fallen that far behind
+constexpr size_t RING_SIZE = 1 << 16;
+constexpr auto RING_WAIT = std::chrono::milliseconds(1);
+constexpr char STATE_MAGIC[4] = {'S', 'B', 'K', 'V'};
+
+// prefix cache snapshots kept, the least recently used beyond this are removed
+constexpr size_t PREFIX_CACHE_MAX = 16;
+
+//
+// file header for save_state/load_state, followed by the tokens then the llama state blob
+//
+struct LlamaStateHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t model_hash;
+  uint32_t n_tokens;
+  uint32_t n_system_tokens;
+  uint64_t n_state;
+};
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+//
+// hashes the canonical path, size and modification time of a file, so that models sharing an
+// architecture and quantization are still told apart
+//
+static uint64_t file_identity(const string &path) {
+  namespace fs = std::filesystem;
+  std::error_code ec;
+  string canonical = fs::weakly_canonical(path, ec).string();
+  uint64_t values[] = {
+    (uint64_t)fs::file_size(path, ec),
+    (uint64_t)fs::last_write_time(path, ec).time_since_epoch().count()
+  };
+  uint64_t result = fnv1a(14695981039346656037ull, canonical.data(), canonical.size());
+  return fnv1a(result, values, sizeof(values));
+}
+
 static bool read_vram(size_t &used, size_t &total) {
   size_t free = 0;
   total = 0;
@@ -29,27 +89,155 @@ static bool read_vram(size_t &used, size_t &total) {
   return false;
 }
 
+//
+// appends a single token to the batch
+//
+static void batch_add(llama_batch &batch, llama_token tok, llama_pos pos, llama_seq_id seq, bool logits) {
+  int i = batch.n_tokens++;
+  batch.token[i] = tok;
+  batch.pos[i] = pos;
+  batch.n_seq_id[i] = 1;
+  batch.seq_id[i][0] = seq;
+  batch.logits[i] = logits;
+}
+
+//
+// single producer, single consumer queue of generated pieces. each entry is a length, the
+// number of tokens decoded up to and including the piece, then the text, published to the
+// consumer by a single store of _head
+//
+struct LlamaRing {
+  LlamaRing() : _head(0), _tail(0) {}
+
+  bool empty() const {
+    return _tail.load(std::memory_order_relaxed) == _head.load(std::memory_order_acquire);
+  }
+
+  // called by the generation thread, false when there is no room for the piece
+  bool push(const string &piece, uint32_t n_decoded) {
+    size_t head = _head.load(std::memory_order_relaxed);
+    size_t tail = _tail.load(std::memory_order_acquire);
+    uint32_t size = piece.size();
+    size_t entry = sizeof(size) + sizeof(n_decoded) + size;
+    bool result = entry <= RING_SIZE - (head - tail);
+    if (result) {
+      copy_in(head, &size, sizeof(size));
+      copy_in(head + sizeof(size), &n_decoded, sizeof(n_decoded));
+      copy_in(head + sizeof(size) + sizeof(n_decoded), piece.data(), size);
+      _head.store(head + entry, std::memory_order_release);
+    }
+    return result;
+  }
+
+  // called by the consumer, false when no piece is ready
+  bool pop(string &piece, uint32_t &n_decoded) {
+    size_t tail = _tail.load(std::memory_order_relaxed);
+    bool result = tail != _head.load(std::memory_order_acquire);
+    if (result) {
+      uint32_t size;
+      copy_out(tail, &size, sizeof(size));
+      copy_out(tail + sizeof(size), &n_decoded, sizeof(n_decoded));
+      piece.resize(size);
+      copy_out(tail + sizeof(size) + sizeof(n_decoded), piece.data(), size);
+      _tail.store(tail + sizeof(size) + sizeof(n_decoded) + size, std::memory_order_release);
+    }
+    return result;
+  }
+
+  private:
+  // positions grow without bound and wrap into the buffer on access
+  void copy_in(size_t pos, const void *src, size_t size) {
+    size_t offset = pos % RING_SIZE;
+    size_t first = std::min(size, RING_SIZE - offset);
+    memcpy(_data + offset, src, first);
+    memcpy(_data, (const char *)src + first, size - first);
+  }
+
+  void copy_out(size_t pos, void *dst, size_t size) const {
+    size_t offset = pos % RING_SIZE;
+    size_t first = std::min(size, RING_SIZE - offset);
+    memcpy(dst, _data + offset, first);
+    memcpy((char *)dst + first, _data, size - first);
+  }
+
+  char _data[RING_SIZE];
+  std::atomic<size_t> _head;  /* advanced by the generation thread */
+  std::atomic<size_t> _tail;  /* advanced by the consumer          */
+};
+
+//
+// state of an iterator generating on a worker thread
+//
+struct LlamaAsync {
+  LlamaAsync() : _n_taken(0), _running(true), _cancel(false) {}
+
+  LlamaRing _ring;
+  // tokens decoded up to the last piece taken by the consumer
+  uint32_t _n_taken;
+  std::thread _thread;
+  std::atomic<bool> _running;
+  std::atomic<bool> _cancel;
+};
+
+//
+// the generation thread holds a reference to the iterator, so it finishes before a move
+//
+static Llama *detach(LlamaIter &iter) {
+  if (iter._async) {
+    iter._llama->stop(iter);
+  }
+  return std::exchange(iter._llama, nullptr);
+}
+
+LlamaSeq::LlamaSeq() :
+  _sampler(nullptr),
+  _n_past(0),
+  _logits_decode(0),
+  _logits_index(-1),
+  _n_system_tokens(0),
+  _sampler_dirty(true) {
+}
+
 LlamaIter::LlamaIter() :
   _llama(nullptr),
+  _seq_id(0),
+  _next_token(LLAMA_TOKEN_NULL),
   _repetition_count(0),
+  _n_decoded(0),
   _tokens_generated(0),
   _has_next(false) {
 }
 
+LlamaIter::~LlamaIter() {
+  if (_async) {
+    _llama->stop(*this);
+  }
+}
+
 LlamaIter::LlamaIter(LlamaIter &&other) noexcept
-  : _llama(std::exchange(other._llama, nullptr))
+  : _llama(detach(other))
+  , _seq_id(other._seq_id)
+  , _accepted(std::move(other._accepted))
+  , _next_token(other._next_token)
   , _last_word(std::move(other._last_word))
   , _t_start(std::move(other._t_start))
   , _repetition_count(other._repetition_count)
-  , _tokens_generated(other._tokens_generated)
+  , _n_decoded(other._n_decoded)
+  , _tokens_generated(other._tokens_generated.load())
   , _has_next(other._has_next) {
 }
 
 Llama::Llama() :
   _model(nullptr),
   _ctx(nullptr),
-  _sampler(nullptr),
   _vocab(nullptr),
+  _batch({}),
+  _n_decode(0),
+  _model_file(0),
+  _draft_model(nullptr),
+  _draft_ctx(nullptr),
+  _draft_batch({}),
+  _n_draft(0),
   _penalty_last_n(0),
   _penalty_repeat(0),
   _penalty_freq(0.0f),
@@ -61,15 +249,17 @@ Llama::Llama() :
   _max_tokens(0),
   _log_level(GGML_LOG_LEVEL_CONT),
   _n_gpu_layers(0),
-  _n_system_tokens(0),
   _is_gemma4(false),
-  _sampler_dirty(false),
   _can_shift(false),
+  _can_truncate(false),
   _memory_flush(false),
-  _seed(LLAMA_DEFAULT_SEED) {
+  _seed(LLAMA_DEFAULT_SEED),
+  _async_iter(nullptr) {
   llama_log_set([](enum ggml_log_level level, const char *text, void *user_data) {
-    Llama *llama = (Llama *)user_data;
-    if (level == GGML_LOG_LEVEL_ERROR && llama->_last_error.empty()) {
+    Llama *llama = log_target != nullptr ? log_target : (Llama *)user_data;
+    // a generation thread owns the error of its llama until it is stopped
+    bool owned = llama == log_target || llama->_async_iter == nullptr;
+    if (owned && level == GGML_LOG_LEVEL_ERROR && llama->_last_error.empty()) {
       // remember the first error message
       llama->_last_error = text;
     }
@@ -82,15 +272,25 @@ Llama::Llama() :
 }
 
 Llama::Llama(Llama &&other) noexcept
-  : _model(std::exchange(other._model, nullptr))
+    // the generation thread refers to other, so it finishes before anything is moved
+  : _model((other.halt(), std::exchange(other._model, nullptr)))
   , _ctx(std::exchange(other._ctx, nullptr))
-  , _sampler(std::exchange(other._sampler, nullptr))
   , _vocab(std::exchange(other._vocab, nullptr))
+  , _seqs(std::move(other._seqs))
+  , _batch(std::exchange(other._batch, {}))
+  , _n_decode(other._n_decode)
+  , _model_file(other._model_file)
   , _stop_sequences(std::move(other._stop_sequences))
   , _grammar_src(std::move(other._grammar_src))
   , _grammar_root(std::move(other._grammar_root))
   , _last_error(std::move(other._last_error))
   , _template(std::move(other._template))
+  , _prefix_cache(std::move(other._prefix_cache))
+  , _draft_model(std::exchange(other._draft_model, nullptr))
+  , _draft_ctx(std::exchange(other._draft_ctx, nullptr))
+  , _draft_batch(std::exchange(other._draft_batch, {}))
+  , _draft_tokens(std::move(other._draft_tokens))
+  , _n_draft(other._n_draft)
   , _penalty_last_n(other._penalty_last_n)
   , _penalty_repeat(other._penalty_repeat)
   , _penalty_freq(other._penalty_freq)
@@ -102,17 +302,32 @@ Llama::Llama(Llama &&other) noexcept
   , _max_tokens(other._max_tokens)
   , _log_level(other._log_level)
   , _n_gpu_layers(other._n_gpu_layers)
-  , _n_system_tokens(other._n_system_tokens)
   , _is_gemma4(other._is_gemma4)
-  , _sampler_dirty(other._sampler_dirty)
   , _can_shift(other._can_shift)
+  , _can_truncate(other._can_truncate)
   , _memory_flush(other._memory_flush)
-  , _seed(other._seed) {
+  , _seed(other._seed)
+  , _async_iter(nullptr) {
 }
 
 Llama::~Llama() {
-  if (_sampler) {
-    llama_sampler_free(_sampler);
+  halt();
+  for (auto &state : _seqs) {
+    if (state._sampler) {
+      llama_sampler_free(state._sampler);
+    }
+  }
+  if (_batch.token) {
+    llama_batch_free(_batch);
+  }
+  if (_draft_batch.token) {
+    llama_batch_free(_draft_batch);
+  }
+  if (_draft_ctx) {
+    llama_free(_draft_ctx);
+  }
+  if (_draft_model) {
+    llama_model_free(_draft_model);
   }
   if (_ctx) {
     llama_free(_ctx);
@@ -124,6 +339,7 @@ Llama::~Llama() {
 }
 
 void Llama::reset() {
+  halt();
   _stop_sequences.clear();
   _last_error.clear();
   _penalty_last_n = 64;
@@ -135,24 +351,47 @@ void Llama::reset() {
   _top_p = 1.0f;
   _min_p = 0.0f;
   _max_tokens = 150;
-  _n_system_tokens = 0;
   _seed = LLAMA_DEFAULT_SEED;
-  _sampler_dirty = true;
-  if (_ctx) {
-    llama_memory_clear(llama_get_memory(_ctx), true);
+  for (auto &state : _seqs) {
+    // keep the resident tokens for reuse by the following add_message calls
+    state._n_past = 0;
+    state._n_system_tokens = 0;
+    state._sampler_dirty = true;
   }
+  if (_model && (llama_model_has_encoder(_model) || !_can_truncate)) {
+    // encoder output is not reusable across prompts, and a sequence that can't be truncated
+    // would be lost entirely when a later message diverges from the resident tokens
+    for (int seq = 0; seq < (int)_seqs.size(); seq++) {
+      reset_seq(seq);
+    }
+  }
+}
+
+bool Llama::reset_seq(llama_seq_id seq) {
+  halt();
+  if (!valid_seq(seq)) {
+    return false;
+  }
+  LlamaSeq &state = _seqs[seq];
+  state._tokens.clear();
+  state._n_past = 0;
+  state._n_system_tokens = 0;
+  state._logits_decode = 0;
+  state._sampler_dirty = true;
+  llama_memory_seq_rm(llama_get_memory(_ctx), seq, -1, -1);
+  return true;
 }
 
 int Llama::max_tool_result_size() {
+  halt();
   // 75% of space available
-  llama_memory_t mem = llama_get_memory(_ctx);
-  llama_pos pos_max = llama_memory_seq_pos_max(mem, 0);
   int n_ctx = llama_n_ctx(_ctx);
-  int space_available = n_ctx - (pos_max + 1);
+  int space_available = n_ctx - kv_used();
   return std::max(256, (space_available * 3) / 4);
 }
 
 bool Llama::is_memory_flush() {
+  halt();
   auto result = _memory_flush;
   if (result) {
     _memory_flush = false;
@@ -160,7 +399,8 @@ bool Llama::is_memory_flush() {
   return result;
 }
 
-bool Llama::load_model(string model_path, int n_ctx, int n_batch, int n_gpu_layers, int log_level) {
+bool Llama::load_model(string model_path, int n_ctx, int n_batch, int n_gpu_layers, int log_level, int n_seq) {
+  halt();
   ggml_backend_load_all();
 
   llama_model_params mparams = llama_model_default_params();
@@ -171,6 +411,7 @@ bool Llama::load_model(string model_path, int n_ctx, int n_batch, int n_gpu_laye
   _last_error.clear();
   _log_level = log_level;
   _n_gpu_layers = n_gpu_layers;
+  _model_file = file_identity(model_path);
   _model = llama_model_load_from_file(model_path.c_str(), mparams);
   if (!_model) {
     set_last_error("Load model");
@@ -179,6 +420,9 @@ bool Llama::load_model(string model_path, int n_ctx, int n_batch, int n_gpu_laye
     cparams.n_ctx   = n_ctx;
     cparams.n_batch = n_batch;
     cparams.n_ubatch = n_batch;
+    cparams.n_seq_max = std::max(1, n_seq);
+    // sequences share the whole context rather than a fixed n_ctx / n_seq slice each
+    cparams.kv_unified = true;
     cparams.no_perf = true;
     cparams.attention_type = LLAMA_ATTENTION_TYPE_UNSPECIFIED;
     cparams.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_ENABLED;
@@ -198,6 +442,9 @@ bool Llama::load_model(string model_path, int n_ctx, int n_batch, int n_gpu_laye
       _template = llama_model_chat_template(_model, nullptr);
       _is_gemma4 = (_template.find("<|turn>model") != string::npos);
       _can_shift = llama_memory_can_shift(llama_get_memory(_ctx));
+      _can_truncate = !llama_model_is_recurrent(_model) && !llama_model_is_hybrid(_model);
+      _seqs.resize(llama_n_seq_max(_ctx));
+      _batch = llama_batch_init(std::max(llama_n_batch(_ctx), llama_n_seq_max(_ctx)), 0, 1);
     }
   }
 
@@ -205,19 +452,24 @@ bool Llama::load_model(string model_path, int n_ctx, int n_batch, int n_gpu_laye
 }
 
 bool Llama::load_embedding_model(string model_path) {
+  halt();
   ggml_backend_load_all();
 
   llama_model_params mparams = llama_model_default_params();
   mparams.n_gpu_layers = 99;
 
   _last_error.clear();
+  _model_file = file_identity(model_path);
   _model = llama_model_load_from_file(model_path.c_str(), mparams);
   if (!_model) {
     set_last_error("Load model");
   } else {
     llama_context_params cparams = llama_context_default_params();
-    cparams.n_ctx        = 512;
-    cparams.n_batch      = 512;
+    cparams.n_ctx        = EMBED_CTX;
+    cparams.n_batch      = EMBED_CTX;
+    cparams.n_ubatch     = EMBED_CTX;
+    cparams.n_seq_max    = EMBED_SEQ_MAX;
+    cparams.kv_unified   = true;
     cparams.embeddings   = true;
     cparams.pooling_type = LLAMA_POOLING_TYPE_MEAN;
 
@@ -226,19 +478,95 @@ bool Llama::load_embedding_model(string model_path) {
       set_last_error("Create context");
     } else {
       _vocab = llama_model_get_vocab(_model);
+      _seqs.resize(1);
+      _batch = llama_batch_init(llama_n_batch(_ctx), 0, 1);
     }
   }
 
   return _last_error.empty();
 }
 
+bool Llama::load_draft_model(string model_path, int n_draft) {
+  halt();
+  if (!_ctx) {
+    set_last_error("Load the main model before the draft model");
+    return false;
+  }
+  if (llama_model_is_recurrent(_model) || llama_model_has_encoder(_model)) {
+    set_last_error("Speculative decoding requires a transformer decoder model");
+    return false;
+  }
+
+  llama_model_params mparams = llama_model_default_params();
+  if (_n_gpu_layers >= 0) {
+    mparams.n_gpu_layers = _n_gpu_layers;
+  }
+
+  _last_error.clear();
+  llama_model *model = llama_model_load_from_file(model_path.c_str(), mparams);
+  if (!model) {
+    set_last_error("Load draft model");
+    return false;
+  }
+
+  // drafted tokens are verified against the main vocabulary so the two must agree
+  const llama_vocab *vocab = llama_model_get_vocab(model);
+  if (llama_vocab_type(vocab) != llama_vocab_type(_vocab) ||
+      llama_vocab_n_tokens(vocab) != llama_vocab_n_tokens(_vocab) ||
+      llama_vocab_bos(vocab) != llama_vocab_bos(_vocab) ||
+      llama_vocab_eos(vocab) != llama_vocab_eos(_vocab)) {
+    llama_model_free(model);
+    set_last_error("Draft model vocabulary does not match the main model");
+    return false;
+  }
+
+  // the verify batch holds the sampled token plus the drafted tokens
+  n_draft = std::clamp(n_draft, 1, (int)llama_n_batch(_ctx) - 1);
+
+  llama_context_params cparams = llama_context_default_params();
+  cparams.n_ctx = llama_n_ctx(_ctx) + n_draft * llama_n_seq_max(_ctx);
+  cparams.n_batch = llama_n_batch(_ctx);
+  cparams.n_ubatch = llama_n_batch(_ctx);
+  cparams.n_seq_max = llama_n_seq_max(_ctx);
+  cparams.kv_unified = true;
+  cparams.no_perf = true;
+  cparams.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_ENABLED;
+  cparams.offload_kqv = true;
+
+  llama_context *ctx = llama_init_from_model(model, cparams);
+  if (!ctx) {
+    llama_model_free(model);
+    set_last_error("Create draft context");
+    return false;
+  }
+
+  if (_draft_batch.token) {
+    llama_batch_free(_draft_batch);
+  }
+  if (_draft_ctx) {
+    llama_free(_draft_ctx);
+  }
+  if (_draft_model) {
+    llama_model_free(_draft_model);
+  }
+  _draft_model = model;
+  _draft_ctx = ctx;
+  _draft_batch = llama_batch_init(llama_n_batch(ctx), 0, 1);
+  _draft_tokens.assign(_seqs.size(), {});
+  _n_draft = n_draft;
+  return true;
+}
+
 void Llama::set_grammar(const string &src, const string &root) {
   _grammar_src = src;
   _grammar_root = root;
   dirty();
 }
 
-bool Llama::add_message(LlamaIter &iter, const string &role, const string &content) {
+bool Llama::add_message(LlamaIter &iter, const string &role, const string &content, llama_seq_id seq) {
+  // no generation thread may decode alongside the new message
+  halt();
+
   llama_chat_message message = {role.c_str(), content.c_str()};
   int buf_size = 2 * (int)(role.size() + content.size() + 64);
   vector<char> buf(buf_size);
@@ -249,6 +577,11 @@ bool Llama::add_message(LlamaIter &iter, const string &role, const string &conte
     return false;
   }
 
+  if (!valid_seq(seq)) {
+    return false;
+  }
+  LlamaSeq &state = _seqs[seq];
+
   if (_is_gemma4) {
     // see: https://ai.google.dev/gemma/docs/core/prompt-formatting-gemma4
     string str;
@@ -273,12 +606,12 @@ bool Llama::add_message(LlamaIter &iter, const string &role, const string &conte
   }
   string prompt(buf.data(), n);
 
-  if (_sampler_dirty) {
+  if (state._sampler_dirty) {
     // avoid wasteful rebuild
-    if (!configure_sampler()) {
+    if (!configure_sampler(state)) {
       return false;
     }
-    _sampler_dirty = false;
+    state._sampler_dirty = false;
   }
 
   vector<llama_token> prompt_tokens = tokenize(prompt);
@@ -286,18 +619,57 @@ bool Llama::add_message(LlamaIter &iter, const string &role, const string &conte
     return false;
   }
 
-  if (role == "system") {
-    // always retain system tokens
-    _n_system_tokens = prompt_tokens.size();
+  // skip over tokens already resident from an earlier identical conversation
+  size_t n_past = state._n_past;
+  size_t n_keep = reuse_prefix(seq, prompt_tokens);
+  if (state._n_past < n_past) {
+    set_last_error("Failed to keep the earlier messages while replacing resident tokens");
+    return false;
+  }
+  vector<llama_token> delta(prompt_tokens.begin() + n_keep, prompt_tokens.end());
+
+  // restore a previously decoded system prompt from the prefix cache
+  string cache_path;
+  // a fully matching message is already resident so there is nothing to decode
+  bool restored = delta.empty();
+  if (!restored && !_prefix_cache.empty() && role == "system" && state._tokens.empty() &&
+      !llama_model_has_encoder(_model)) {
+    cache_path = prefix_cache_path(prompt_tokens);
+    FILE *fp = fopen(cache_path.c_str(), "rb");
+    if (fp != nullptr) {
+      fclose(fp);
+      string last_error = _last_error;
+      restored = load_state(cache_path, seq) && state._tokens == prompt_tokens;
+      if (restored) {
+        // the modification time orders entries for eviction
+        std::error_code ec;
+        std::filesystem::last_write_time(cache_path, std::filesystem::file_time_type::clock::now(), ec);
+      } else {
+        // stale or colliding entry, decode as normal
+        reset_seq(seq);
+        _last_error = last_error;
+      }
+    }
   }
 
-  if (!make_space_for_tokens((prompt_tokens.size() * 3) / 2)) {
-    return false;
+  if (!restored) {
+    if (!make_space_for_tokens(seq, (delta.size() * 3) / 2)) {
+      return false;
+    }
+
+    // batch decode tokens
+    if (!batch_decode_tokens(seq, delta)) {
+      return false;
+    }
+
+    if (!cache_path.empty() && state._tokens == prompt_tokens && save_state(cache_path, seq)) {
+      trim_prefix_cache();
+    }
   }
 
-  // batch decode tokens
-  if (!batch_decode_tokens(prompt_tokens)) {
-    return false;
+  if (role == "system") {
+    // always retain system tokens
+    state._n_system_tokens = state._n_past;
   }
 
   // handle encoder models
@@ -309,73 +681,296 @@ bool Llama::add_message(LlamaIter &iter, const string &role, const string &conte
       decoder_start_token_id = llama_vocab_bos(_vocab);
     }
 
-    llama_batch decoder_batch = llama_batch_get_one(&decoder_start_token_id, 1);
-    if (llama_decode(_ctx, decoder_batch)) {
+    if (decode_seq(seq, &decoder_start_token_id, 1)) {
       set_last_error("Failed to evaluate decoder start token");
       return false;
     }
   }
 
   iter._tokens_generated = 0;
+  iter._n_decoded = 0;
   iter._t_start = std::chrono::high_resolution_clock::now();
   iter._llama = this;
+  iter._seq_id = seq;
+  iter._accepted.clear();
+  iter._next_token = LLAMA_TOKEN_NULL;
   iter._has_next = true;
   return true;
 }
 
 string Llama::next(LlamaIter &iter) {
-  if (!iter._has_next) {
+  string result;
+  if (iter._async) {
+    // poll the generation thread
+    try_next(iter, result);
+  } else if (!iter._has_next) {
     set_last_error("Iteration beyond end of stream");
-    return "";
+  } else {
+    halt();
+    step(iter, result);
+  }
+  return result;
+}
+
+bool Llama::step(LlamaIter &iter, string &out) {
+  out.clear();
+  if (!iter._accepted.empty()) {
+    // drafted token verified and decoded by an earlier call
+    llama_token tok = iter._accepted.front();
+    iter._accepted.erase(iter._accepted.begin());
+    out = token_to_string(iter, tok);
+    return true;
   }
 
-  // sample the next token from the current logits
-  llama_token tok = llama_sampler_sample(_sampler, _ctx, -1);
+  // sample the next token from the current logits, unless speculation already did
+  llama_token tok = std::exchange(iter._next_token, LLAMA_TOKEN_NULL);
+  if (tok == LLAMA_TOKEN_NULL) {
+    tok = sample(iter._seq_id);
+  }
 
   // end-of-generation check
-  if (llama_vocab_is_eog(_vocab, tok)) {
+  if (tok == LLAMA_TOKEN_NULL || llama_vocab_is_eog(_vocab, tok)) {
     iter._has_next = false;
-    return "";
+    return true;
   }
 
-  string result = token_to_string(iter, tok);
+  out = token_to_string(iter, tok);
 
-  // prepare the next batch with the sampled token
-  llama_batch batch = llama_batch_get_one(&tok, 1);
-  if (llama_decode(_ctx, batch)) {
+  if (_draft_ctx) {
+    // decode the sampled token along with the drafted tokens the main model agrees with
+    iter._next_token = speculate(iter._seq_id, tok, _n_draft + 2, iter._accepted);
+    if (iter._next_token == LLAMA_TOKEN_NULL) {
+      out.clear();
+      return false;
+    }
+    iter._n_decoded += 1 + iter._accepted.size();
+  } else if (decode_seq(iter._seq_id, &tok, 1)) {
+    // decode the sampled token to produce the next logits
     set_last_error("Failed to evaluate token during generation");
-    return "";
+    out.clear();
+    return false;
+  } else {
+    iter._n_decoded++;
+  }
+  return true;
+}
+
+bool Llama::start(LlamaIter &iter) {
+  if (iter._async) {
+    set_last_error("Generation already started");
+    return false;
+  }
+  halt();
+  iter._llama = this;
+  if (_can_truncate) {
+    _async_iter = &iter;
+    iter._async = std::make_unique<LlamaAsync>();
+    iter._async->_n_taken = iter._n_decoded;
+    iter._async->_thread = std::thread(&Llama::generate, this, std::ref(iter));
+  }
+  // otherwise the tokens decoded ahead of the reader could not be removed by stop(), so
+  // try_next() produces each piece when it is called
+  return true;
+}
+
+void Llama::generate(LlamaIter &iter) {
+  log_target = this;
+  LlamaAsync &async = *iter._async;
+  string piece;
+  while (iter._has_next && !async._cancel.load(std::memory_order_relaxed) && step(iter, piece)) {
+    // verified drafts are decoded ahead of their pieces
+    uint32_t n_decoded = iter._n_decoded - iter._accepted.size();
+    while (!piece.empty() && !async._ring.push(piece, n_decoded)) {
+      // the caller has fallen behind
+      if (async._cancel.load(std::memory_order_relaxed)) {
+        break;
+      }
+      std::this_thread::sleep_for(RING_WAIT);
+    }
+  }
+  async._running.store(false, std::memory_order_release);
+}
+
+bool Llama::has_next(const LlamaIter &iter) const {
+  bool result;
+  if (iter._async) {
+    // read before the ring, so that the final pieces are visible once the thread has finished
+    bool running = iter._async->_running.load(std::memory_order_acquire);
+    result = running || !iter._async->_ring.empty();
+  } else {
+    result = iter._has_next;
   }
+  return result;
+}
 
+bool Llama::try_next(LlamaIter &iter, string &out) {
+  bool result;
+  if (iter._async) {
+    result = iter._async->_ring.pop(out, iter._async->_n_taken);
+  } else {
+    // without a generation thread the next piece is produced now
+    result = iter._has_next;
+    out = result ? next(iter) : "";
+  }
   return result;
 }
 
+void Llama::stop(LlamaIter &iter) {
+  if (iter._async) {
+    iter._async->_cancel.store(true, std::memory_order_relaxed);
+    iter._async->_thread.join();
+    size_t n_unseen = iter._n_decoded - iter._async->_n_taken;
+    iter._async.reset();
+    if (_async_iter == &iter) {
+      _async_iter = nullptr;
+    }
+    if (n_unseen > 0) {
+      // pieces not yet taken are discarded, so their tokens leave the conversation too
+      size_t n_tokens = _seqs[iter._seq_id]._tokens.size();
+      iter._n_decoded -= n_unseen;
+      iter._accepted.clear();
+      iter._next_token = LLAMA_TOKEN_NULL;
+      iter._has_next = n_unseen < n_tokens &&
+                       truncate_seq(iter._seq_id, n_tokens - n_unseen) &&
+                       restore_logits(iter._seq_id);
+    }
+  }
+}
+
+void Llama::halt() {
+  if (_async_iter != nullptr) {
+    stop(*_async_iter);
+  }
+}
+
+bool Llama::next_batch(const vector<LlamaIter *> &iters, vector<string> &out) {
+  halt();
+  int n_iters = iters.size();
+  vector<llama_token> tokens(n_iters, LLAMA_TOKEN_NULL);
+  out.assign(n_iters, "");
+
+  // sample every active sequence first, restoring clobbered logits may itself decode
+  for (int i = 0; i < n_iters; i++) {
+    LlamaIter &iter = *iters[i];
+    if (!iter._has_next) {
+      continue;
+    }
+    for (int j = 0; j < i; j++) {
+      if (iters[j]->_seq_id == iter._seq_id) {
+        set_last_error(std::format("Duplicate sequence {} in batch", iter._seq_id));
+        return false;
+      }
+    }
+    if (!iter._accepted.empty()) {
+      // drafted token verified and decoded by an earlier speculative next()
+      out[i] = token_to_string(iter, iter._accepted.front());
+      iter._accepted.erase(iter._accepted.begin());
+      continue;
+    }
+    llama_token tok = std::exchange(iter._next_token, LLAMA_TOKEN_NULL);
+    if (tok == LLAMA_TOKEN_NULL) {
+      tok = sample(iter._seq_id);
+    }
+    if (tok == LLAMA_TOKEN_NULL || llama_vocab_is_eog(_vocab, tok)) {
+      iter._has_next = false;
+    } else {
+      out[i] = token_to_string(iter, tok);
+      tokens[i] = tok;
+    }
+  }
+
+  // pack the next token of each sequence into one batch
+  llama_memory_t mem = llama_get_memory(_ctx);
+  _batch.n_tokens = 0;
+  vector<int> index(n_iters, -1);
+  for (int i = 0; i < n_iters; i++) {
+    if (tokens[i] != LLAMA_TOKEN_NULL) {
+      llama_seq_id seq = iters[i]->_seq_id;
+      index[i] = _batch.n_tokens;
+      batch_add(_batch, tokens[i], llama_memory_seq_pos_max(mem, seq) + 1, seq, true);
+    }
+  }
+
+  if (_batch.n_tokens == 0) {
+    return true;
+  }
+
+  int32_t result = llama_decode(_ctx, _batch);
+  if (result != 0) {
+    set_decode_error(iters[0]->_seq_id, result, 0, _batch.n_tokens);
+    for (int i = 0; i < n_iters; i++) {
+      if (index[i] != -1) {
+        iters[i]->_has_next = false;
+      }
+    }
+    return false;
+  }
+
+  _n_decode++;
+  for (int i = 0; i < n_iters; i++) {
+    if (index[i] != -1) {
+      LlamaSeq &state = _seqs[iters[i]->_seq_id];
+      state._logits_decode = _n_decode;
+      state._logits_index = index[i];
+      state._tokens.push_back(tokens[i]);
+      state._n_past = state._tokens.size();
+    }
+  }
+  return true;
+}
+
 string Llama::all(LlamaIter &iter) {
   string out;
 
-  vector<llama_token> decoded;
+  if (iter._async) {
+    // collect the rest of the generation thread's output
+    string piece;
+    while (has_next(iter)) {
+      if (try_next(iter, piece)) {
+        out.append(piece);
+      } else {
+        std::this_thread::sleep_for(RING_WAIT);
+      }
+    }
+    stop(iter);
+    return out;
+  }
+
+  halt();
+
+  // include tokens already verified by a speculative call to next()
+  vector<llama_token> decoded = std::move(iter._accepted);
+  iter._accepted.clear();
   decoded.reserve(_max_tokens);
 
-  int generated = 0;
+  llama_token tok = std::exchange(iter._next_token, LLAMA_TOKEN_NULL);
 
-  while (generated < _max_tokens) {
-    // sample the next token from the current logits
-    llama_token tok = llama_sampler_sample(_sampler, _ctx, -1);
+  while ((int)decoded.size() < _max_tokens) {
+    if (tok == LLAMA_TOKEN_NULL) {
+      // sample the next token from the current logits
+      tok = sample(iter._seq_id);
+    }
 
     // end-of-generation check
-    if (llama_vocab_is_eog(_vocab, tok)) {
+    if (tok == LLAMA_TOKEN_NULL || llama_vocab_is_eog(_vocab, tok)) {
       break;
     }
 
     // append token to decoded list
     decoded.push_back(tok);
-    ++generated;
 
-    // decode the token
-    llama_batch batch = llama_batch_get_one(&tok, 1);
-    if (llama_decode(_ctx, batch)) {
+    if (_draft_ctx) {
+      // decode the token along with the drafted tokens the main model agrees with
+      tok = speculate(iter._seq_id, tok, _max_tokens - decoded.size() + 1, decoded);
+      if (tok == LLAMA_TOKEN_NULL && (int)decoded.size() < _max_tokens) {
+        break;
+      }
+    } else if (decode_seq(iter._seq_id, &tok, 1)) {
+      // decode the token
       set_last_error("Failed to evaluate token during generation");
       break;
+    } else {
+      tok = LLAMA_TOKEN_NULL;
     }
   }
 
@@ -393,22 +988,19 @@ string Llama::all(LlamaIter &iter) {
 }
 
 float Llama::memory_kv_percent() {
-  llama_memory_t mem = llama_get_memory(_ctx);
-  llama_pos pos_max  = llama_memory_seq_pos_max(mem, 0);
-  int n_ctx          = llama_n_ctx(_ctx);
-  int kv_used        = (pos_max < 0) ? 0 : (int)pos_max + 1;
-  return 100.0f * kv_used / n_ctx;
+  halt();
+  int n_ctx = llama_n_ctx(_ctx);
+  return 100.0f * kv_used() / n_ctx;
 }
 
 LlamaMemoryInfo Llama::memory_info() {
+  halt();
   LlamaMemoryInfo info = {};
 
   // KV cache usage
-  llama_memory_t mem = llama_get_memory(_ctx);
-  llama_pos pos_max  = llama_memory_seq_pos_max(mem, 0);
   int n_ctx          = llama_n_ctx(_ctx);
   info.kv_total      = n_ctx;
-  info.kv_used       = (pos_max < 0) ? 0 : (int)pos_max + 1;
+  info.kv_used       = kv_used();
   info.kv_percent    = 100.0f * info.kv_used / info.kv_total;
 
   // Model layers
@@ -458,88 +1050,139 @@ LlamaMemoryInfo Llama::memory_info() {
 }
 
 bool Llama::embed_text(const std::string &text, std::vector<float> &out, int embed_dim) {
-  vector<llama_token> tokens = tokenize(text);
-  if (tokens.size() == 0) {
+  vector<vector<float>> result;
+  if (!embed_batch({text}, result, embed_dim)) {
     return false;
   }
+  out = std::move(result[0]);
+  return true;
+}
 
-  // truncate to context window
-  int n_ctx = llama_n_ctx(_ctx);
-  int n = tokens.size();
-  if (n > n_ctx) {
-    set_last_error(std::format("warning: chunk truncated {} -> {} tokens ", n, n_ctx));
-    n = n_ctx;
-    tokens.resize(n);
-  }
+bool Llama::embed_batch(const vector<string> &texts, vector<vector<float>> &out, int embed_dim) {
+  halt();
+  llama_memory_t mem = llama_get_memory(_ctx);
+  int n_batch = std::min(llama_n_batch(_ctx), llama_n_ctx(_ctx));
+  int n_seq_max = llama_n_seq_max(_ctx);
+  int n_max = std::min(n_batch, EMBED_MAX_TOKENS);
+
+  // the batch holds whole texts, each as its own sequence starting at position zero
+  vector<size_t> pending;
+  vector<int> last_index;
+  auto flush = [&]() -> bool {
+    if (pending.empty()) {
+      return true;
+    }
+    if (mem != nullptr) {
+      llama_memory_clear(mem, true);
+    }
+    int32_t result = llama_decode(_ctx, _batch);
+    if (result != 0) {
+      set_decode_error(0, result, 0, _batch.n_tokens);
+      return false;
+    }
+    for (size_t seq = 0; seq < pending.size(); seq++) {
+      float *emb = llama_get_embeddings_seq(_ctx, seq);
+      if (!emb) {
+        emb = llama_get_embeddings_ith(_ctx, last_index[seq]);
+      }
+      if (!emb) {
+        set_last_error("no embedding returned");
+        return false;
+      }
 
-  llama_memory_clear(llama_get_memory(_ctx), true);
+      vector<float> &vec = out[pending[seq]];
+      vec.assign(emb, emb + embed_dim);
 
-  if (!batch_decode_tokens(tokens)) {
-    return false;
-  }
+      /* L2 normalize */
+      float norm = 0.0f;
+      for (float v : vec) {
+        norm += v * v;
+      }
+      norm = std::sqrt(norm);
+      if (norm > 1e-9f) {
+        for (float &v : vec) {
+          v /= norm;
+        }
+      }
+    }
+    pending.clear();
+    last_index.clear();
+    _batch.n_tokens = 0;
+    return true;
+  };
 
-  float *emb = llama_get_embeddings_seq(_ctx, 0);
-  if (!emb) {
-    emb = llama_get_embeddings_ith(_ctx, n - 1);
+  for (auto &state : _seqs) {
+    state._tokens.clear();
+    state._n_past = 0;
   }
 
-  if (!emb) {
-    set_last_error("no embedding returned");
-    return false;
-  }
+  out.assign(texts.size(), {});
+  _batch.n_tokens = 0;
+  for (size_t i = 0; i < texts.size(); i++) {
+    vector<llama_token> tokens = tokenize(texts[i]);
+    if (tokens.size() == 0) {
+      return false;
+    }
 
-  out.assign(emb, emb + embed_dim);
+    // truncate to the per-text window
+    int n = tokens.size();
+    if (n > n_max) {
+      set_last_error(std::format("warning: chunk truncated {} -> {} tokens ", n, n_max));
+      n = n_max;
+    }
 
-  /* L2 normalize */
-  float norm = 0.0f;
-  for (float v : out) {
-    norm += v * v;
-  }
-  norm = std::sqrt(norm);
-  if (norm > 1e-9f) {
-    for (float &v : out) {
-      v /= norm;
+    if (_batch.n_tokens + n > n_batch || (int)pending.size() == n_seq_max) {
+      if (!flush()) {
+        return false;
+      }
+    }
+
+    // pooled embeddings require every token as an output
+    llama_seq_id seq = pending.size();
+    for (int j = 0; j < n; j++) {
+      batch_add(_batch, tokens[j], j, seq, true);
     }
+    pending.push_back(i);
+    last_index.push_back(_batch.n_tokens - 1);
   }
 
-  return true;
+  return flush();
 }
 
-bool Llama::batch_decode_tokens(vector<llama_token> &tokens) {
+bool Llama::batch_decode_tokens(llama_seq_id seq, vector<llama_token> &tokens) {
   uint32_t n_batch = llama_n_batch(_ctx);
   for (size_t i = 0; i < tokens.size(); i += n_batch) {
     size_t batch_size = std::min((size_t)n_batch, tokens.size() - i);
-    llama_batch batch = llama_batch_get_one(tokens.data() + i, batch_size);
-    int result = llama_decode(_ctx, batch);
+    int result = decode_seq(seq, tokens.data() + i, batch_size);
     if (result == 1) {
       // KV full or fragmented mid-batch - evict oldest tokens and retry
-      if (!make_space_for_tokens(n_batch)) {
-        set_decode_error(result, i, tokens.size());
+      if (!make_space_for_tokens(seq, n_batch)) {
+        set_decode_error(seq, result, i, tokens.size());
         return false;
       }
-      result = llama_decode(_ctx, batch);
+      result = decode_seq(seq, tokens.data() + i, batch_size);
       if (result == 1) {
         // Eviction reported enough logical space but decode still failed -
         // this is fragmentation, not a real space shortage. No defrag API
         // is available, so fall back to a full non-system flush, which
         // guarantees one contiguous block.
-        if (!full_flush_except_system()) {
-          set_decode_error(result, i, tokens.size());
+        if (!full_flush_except_system(seq)) {
+          set_decode_error(seq, result, i, tokens.size());
           return false;
         }
         _memory_flush = true;
-        result = llama_decode(_ctx, batch);
+        result = decode_seq(seq, tokens.data() + i, batch_size);
       }
     }
     if (result != 0) {
-      set_decode_error(result, i, tokens.size());
+      set_decode_error(seq, result, i, tokens.size());
       return false;
     }
   }
   return true;
 }
 
-bool Llama::configure_sampler() {
+bool Llama::configure_sampler(LlamaSeq &state) {
   auto sparams = llama_sampler_chain_default_params();
   sparams.no_perf = false;
   llama_sampler *chain = llama_sampler_chain_init(sparams);
@@ -571,28 +1214,100 @@ bool Llama::configure_sampler() {
     llama_sampler_chain_add(chain, llama_sampler_init_temp(_temperature));
     llama_sampler_chain_add(chain, llama_sampler_init_dist(_seed));
   }
-  if (_sampler) {
-    llama_sampler_free(_sampler);
+  if (state._sampler) {
+    llama_sampler_free(state._sampler);
   }
-  _sampler = chain;
+  state._sampler = chain;
   return true;
 }
 
-bool Llama::full_flush_except_system() {
+//
+// decodes the tokens at the end of the given sequence, requesting logits for the final token
+//
+int32_t Llama::decode_seq(llama_seq_id seq, const llama_token *tokens, int n_tokens) {
+  llama_memory_t mem = llama_get_memory(_ctx);
+  llama_pos pos = mem != nullptr ? llama_memory_seq_pos_max(mem, seq) + 1 : 0;
+  // pooled embeddings require every token as an output
+  bool output_all = llama_pooling_type(_ctx) != LLAMA_POOLING_TYPE_NONE;
+  _batch.n_tokens = 0;
+  for (int i = 0; i < n_tokens; i++) {
+    batch_add(_batch, tokens[i], pos + i, seq, output_all || i == n_tokens - 1);
+  }
+  int32_t result = llama_decode(_ctx, _batch);
+  if (result == 0 && n_tokens > 0) {
+    LlamaSeq &state = _seqs[seq];
+    state._logits_decode = ++_n_decode;
+    state._logits_index = n_tokens - 1;
+    state._tokens.insert(state._tokens.end(), tokens, tokens + n_tokens);
+    state._n_past = state._tokens.size();
+  }
+  return result;
+}
+
+void Llama::dirty() {
+  halt();
+  for (auto &state : _seqs) {
+    state._sampler_dirty = true;
+  }
+}
+
+bool Llama::full_flush_except_system(llama_seq_id seq) {
   llama_memory_t mem = llama_get_memory(_ctx);
-  llama_pos pos_min = llama_memory_seq_pos_min(mem, 0);
+  llama_pos pos_min = llama_memory_seq_pos_min(mem, seq);
   if (pos_min < 0) {
     return true; // already empty
   }
-  llama_pos flush_start = pos_min + _n_system_tokens;
-  bool ok = llama_memory_seq_rm(mem, 0, flush_start, -1);
+  LlamaSeq &state = _seqs[seq];
+  llama_pos flush_start = pos_min + state._n_system_tokens;
+  bool ok = llama_memory_seq_rm(mem, seq, flush_start, -1);
   if (!ok) {
     set_last_error("Failed to flush memory past system tokens");
     return false;
   }
+  if ((int)state._tokens.size() > state._n_system_tokens) {
+    state._tokens.resize(state._n_system_tokens);
+  }
+  state._n_past = state._tokens.size();
   return true;
 }
 
+//
+// discards the resident tokens from position n_tokens onwards
+//
+bool Llama::truncate_seq(llama_seq_id seq, size_t n_tokens) {
+  LlamaSeq &state = _seqs[seq];
+  bool result = true;
+  if (n_tokens < state._tokens.size()) {
+    llama_memory_t mem = llama_get_memory(_ctx);
+    llama_pos pos_min = llama_memory_seq_pos_min(mem, seq);
+    if (pos_min < 0 || !llama_memory_seq_rm(mem, seq, pos_min + n_tokens, -1)) {
+      // partial removal is unsupported (for example recurrent models), discard everything
+      llama_memory_seq_rm(mem, seq, -1, -1);
+      n_tokens = 0;
+      result = false;
+    }
+    state._tokens.resize(n_tokens);
+    state._logits_decode = 0;
+  }
+  state._n_past = std::min(state._n_past, state._tokens.size());
+  return result;
+}
+
+//
+// returns the number of KV cells in use across all sequences
+//
+int Llama::kv_used() {
+  int result = 0;
+  llama_memory_t mem = llama_get_memory(_ctx);
+  for (int seq = 0; seq < (int)_seqs.size(); seq++) {
+    llama_pos pos_max = llama_memory_seq_pos_max(mem, seq);
+    if (pos_max >= 0) {
+      result += pos_max - llama_memory_seq_pos_min(mem, seq) + 1;
+    }
+  }
+  return result;
+}
+
 // Makes space in the context for n_tokens by removing old tokens if necessary
 // Returns true if successful, false if impossible to make space
 //
@@ -602,9 +1317,10 @@ bool Llama::full_flush_except_system() {
 // - Otherwise, removes oldest tokens to make room
 //
 // Parameters:
+//   seq       - Sequence from which old tokens are evicted
 //   n_tokens  - Number of tokens we need space for
 //
-bool Llama::make_space_for_tokens(int n_tokens) {
+bool Llama::make_space_for_tokens(llama_seq_id seq, int n_tokens) {
   int n_ctx = llama_n_ctx(_ctx);
   if (n_tokens > n_ctx) {
     set_last_error("Too many tokens, increase context size (n_ctx)");
@@ -614,17 +1330,19 @@ bool Llama::make_space_for_tokens(int n_tokens) {
   llama_memory_t mem = llama_get_memory(_ctx);
 
   // Get current position range
-  llama_pos pos_min = llama_memory_seq_pos_min(mem, 0);
-  llama_pos pos_max = llama_memory_seq_pos_max(mem, 0);
+  llama_pos pos_min = llama_memory_seq_pos_min(mem, seq);
+  llama_pos pos_max = llama_memory_seq_pos_max(mem, seq);
 
   // Empty memory - nothing to do
   if (pos_max < 0) {
     return true;
   }
 
+  // other sequences share the same cache
+  int n_system_tokens = _seqs[seq]._n_system_tokens;
   int current_used = pos_max - pos_min + 1;
   int space_needed = n_tokens;
-  int space_available = n_ctx - current_used;
+  int space_available = n_ctx - kv_used();
 
   // Already have enough space
   if (space_available >= space_needed) {
@@ -634,8 +1352,8 @@ bool Llama::make_space_for_tokens(int n_tokens) {
   // Calculate how many tokens to remove
   int tokens_to_remove = space_needed - space_available;
 
-  // Can't remove more than we have (minus _n_system_tokens)
-  int removable = current_used - _n_system_tokens;
+  // Can't remove more than we have (minus n_system_tokens)
+  int removable = current_used - n_system_tokens;
   if (tokens_to_remove > removable) {
     set_last_error("Can't make enough space while keeping num_system_tokens tokens");
     return false;
@@ -645,18 +1363,333 @@ bool Llama::make_space_for_tokens(int n_tokens) {
     return false;
   }
 
-  llama_pos remove_start = pos_min + _n_system_tokens;
+  llama_pos remove_start = pos_min + n_system_tokens;
 
   // Remove oldest tokens (from pos_min to pos_min + tokens_to_remove)
-  llama_memory_seq_rm(mem, 0, remove_start, remove_start + tokens_to_remove);
+  llama_memory_seq_rm(mem, seq, remove_start, remove_start + tokens_to_remove);
 
   // Shift remaining tokens down
-  llama_memory_seq_add(mem, 0, remove_start + tokens_to_remove, -1, -tokens_to_remove);
+  llama_memory_seq_add(mem, seq, remove_start + tokens_to_remove, -1, -tokens_to_remove);
+
+  vector<llama_token> &tokens = _seqs[seq]._tokens;
+  if ((int)tokens.size() >= n_system_tokens + tokens_to_remove) {
+    tokens.erase(tokens.begin() + n_system_tokens, tokens.begin() + n_system_tokens + tokens_to_remove);
+  }
+  _seqs[seq]._n_past = tokens.size();
 
   set_last_error(std::format("made space for {} tokens", n_tokens));
   return true;
 }
 
+//
+// re-decodes the final token of the sequence after another sequence replaced the logits
+//
+bool Llama::restore_logits(llama_seq_id seq) {
+  LlamaSeq &state = _seqs[seq];
+  if (state._tokens.empty()) {
+    set_last_error("No pending logits for sequence");
+    return false;
+  }
+  llama_token tok = state._tokens.back();
+  if (!truncate_seq(seq, state._tokens.size() - 1) || decode_seq(seq, &tok, 1)) {
+    set_last_error("Failed to restore sequence logits");
+    return false;
+  }
+  return true;
+}
+
+//
+// returns the number of leading tokens already resident after the current conversation,
+// the remaining resident tokens are discarded when the input diverges from them
+//
+size_t Llama::reuse_prefix(llama_seq_id seq, const vector<llama_token> &tokens) {
+  LlamaSeq &state = _seqs[seq];
+  const vector<llama_token> &resident = state._tokens;
+  size_t n_past = state._n_past;
+  size_t n_keep = 0;
+  while (n_keep < tokens.size() &&
+         n_past + n_keep < resident.size() &&
+         resident[n_past + n_keep] == tokens[n_keep]) {
+    n_keep++;
+  }
+  if (n_keep < tokens.size() && !truncate_seq(seq, n_past + n_keep)) {
+    // the whole sequence was discarded, including the earlier messages
+    n_keep = 0;
+    state._n_system_tokens = 0;
+  }
+  state._n_past = std::min(n_past + n_keep, state._tokens.size());
+  return n_keep;
+}
+
+//
+// proposes up to n_draft tokens following the sequence and tok using greedy draft model decoding
+//
+bool Llama::draft(llama_seq_id seq, llama_token tok, int n_draft, vector<llama_token> &drafted) {
+  const vector<llama_token> &tokens = _seqs[seq]._tokens;
+  vector<llama_token> &resident = _draft_tokens[seq];
+  llama_memory_t mem = llama_get_memory(_draft_ctx);
+
+  // keep the draft cache in step with the main sequence, decoding from the first difference
+  size_t n_keep = 0;
+  while (n_keep < tokens.size() && n_keep < resident.size() && resident[n_keep] == tokens[n_keep]) {
+    n_keep++;
+  }
+  if (n_keep < resident.size() && !llama_memory_seq_rm(mem, seq, n_keep, -1)) {
+    llama_memory_seq_rm(mem, seq, -1, -1);
+    n_keep = 0;
+  }
+  resident.resize(n_keep);
+
+  vector<llama_token> pending(tokens.begin() + n_keep, tokens.end());
+  pending.push_back(tok);
+
+  size_t n_batch = llama_n_batch(_draft_ctx);
+  for (size_t i = 0; i < pending.size(); i += n_batch) {
+    size_t batch_size = std::min(n_batch, pending.size() - i);
+    _draft_batch.n_tokens = 0;
+    for (size_t j = 0; j < batch_size; j++) {
+      batch_add(_draft_batch, pending[i + j], resident.size() + j, seq, i + j == pending.size() - 1);
+    }
+    if (llama_decode(_draft_ctx, _draft_batch) != 0) {
+      llama_memory_seq_rm(mem, seq, -1, -1);
+      resident.clear();
+      return false;
+    }
+    resident.insert(resident.end(), pending.begin() + i, pending.begin() + i + batch_size);
+  }
+
+  int n_vocab = llama_vocab_n_tokens(_vocab);
+  int index = _draft_batch.n_tokens - 1;
+  for (int i = 0; i < n_draft; i++) {
+    const float *logits = llama_get_logits_ith(_draft_ctx, index);
+    llama_token next = std::max_element(logits, logits + n_vocab) - logits;
+    drafted.push_back(next);
+    if (i + 1 == n_draft || llama_vocab_is_eog(_vocab, next)) {
+      break;
+    }
+    _draft_batch.n_tokens = 0;
+    batch_add(_draft_batch, next, resident.size(), seq, true);
+    if (llama_decode(_draft_ctx, _draft_batch) != 0) {
+      break;
+    }
+    resident.push_back(next);
+    index = 0;
+  }
+  return true;
+}
+
+//
+// decodes tok together with the tokens proposed by the draft model, appending to accepted the
+// drafted tokens matching what the main model samples itself. Returns the main model's token
+// following those, or LLAMA_TOKEN_NULL on failure or once n_max tokens including tok are produced
+//
+llama_token Llama::speculate(llama_seq_id seq, llama_token tok, int n_max, vector<llama_token> &accepted) {
+  LlamaSeq &state = _seqs[seq];
+  vector<llama_token> drafted;
+  if (n_max > 1 && !draft(seq, tok, std::min(_n_draft, n_max - 1), drafted)) {
+    // fall back to decoding the single token
+    drafted.clear();
+  }
+
+  // verify the drafted tokens with one decode, every position needs logits
+  llama_pos pos = llama_memory_seq_pos_max(llama_get_memory(_ctx), seq) + 1;
+  int n_drafted = drafted.size();
+  _batch.n_tokens = 0;
+  batch_add(_batch, tok, pos, seq, true);
+  for (int i = 0; i < n_drafted; i++) {
+    batch_add(_batch, drafted[i], pos + i + 1, seq, true);
+  }
+  int32_t status = llama_decode(_ctx, _batch);
+  if (status == 1 && n_drafted > 0) {
+    // no room for the drafted tokens
+    n_drafted = 0;
+    _batch.n_tokens = 1;
+    status = llama_decode(_ctx, _batch);
+  }
+  if (status != 0) {
+    set_last_error("Failed to evaluate token during generation");
+    return LLAMA_TOKEN_NULL;
+  }
+  _n_decode++;
+  state._tokens.push_back(tok);
+  state._tokens.insert(state._tokens.end(), drafted.begin(), drafted.begin() + n_drafted);
+  state._n_past = state._tokens.size();
+
+  // accept the longest run where the main model samples the drafted token, so the
+  // output matches non-speculative generation
+  llama_token result = LLAMA_TOKEN_NULL;
+  int n_accepted = 0;
+  for (int i = 0; i <= n_drafted && n_accepted + 1 < n_max; i++) {
+    llama_token next = llama_sampler_sample(state._sampler, _ctx, i);
+    if (i < n_drafted && next == drafted[i] && !llama_vocab_is_eog(_vocab, next)) {
+      accepted.push_back(next);
+      n_accepted++;
+    } else {
+      result = next;
+      break;
+    }
+  }
+
+  // discard the rejected tokens, the logits following the last accepted token remain valid
+  if (!truncate_seq(seq, state._tokens.size() - (n_drafted - n_accepted))) {
+    set_last_error("Failed to discard rejected draft tokens");
+    return LLAMA_TOKEN_NULL;
+  }
+  state._logits_decode = _n_decode;
+  state._logits_index = n_accepted;
+  return result;
+}
+
+//
+// samples the next token for the sequence, LLAMA_TOKEN_NULL on failure
+//
+llama_token Llama::sample(llama_seq_id seq) {
+  LlamaSeq &state = _seqs[seq];
+  if (state._n_past < state._tokens.size()) {
+    // generation continues from the end of the reused prefix
+    truncate_seq(seq, state._n_past);
+  }
+  if (state._logits_decode != _n_decode && !restore_logits(seq)) {
+    return LLAMA_TOKEN_NULL;
+  }
+  return llama_sampler_sample(state._sampler, _ctx, state._logits_index);
+}
+
+//
+// identifies the loaded model so that snapshots are never restored into a different model
+//
+uint64_t Llama::model_hash() {
+  char desc[256];
+  int n = llama_model_desc(_model, desc, sizeof(desc));
+  uint64_t values[] = {
+    llama_model_n_params(_model),
+    llama_model_size(_model),
+    (uint64_t)llama_model_n_embd(_model),
+    (uint64_t)llama_model_n_layer(_model),
+    (uint64_t)llama_n_ctx(_ctx),
+    _model_file
+  };
+  uint64_t result = fnv1a(14695981039346656037ull, desc, n > 0 ? std::min(n, (int)sizeof(desc)) : 0);
+  return fnv1a(result, values, sizeof(values));
+}
+
+string Llama::prefix_cache_path(const vector<llama_token> &tokens) {
+  uint64_t hash = fnv1a(model_hash(), tokens.data(), tokens.size() * sizeof(llama_token));
+  return std::format("{}/{:016x}.kv", _prefix_cache, hash);
+}
+
+void Llama::trim_prefix_cache() {
+  namespace fs = std::filesystem;
+  std::error_code ec;
+  vector<std::pair<fs::file_time_type, fs::path>> entries;
+  for (const auto &entry : fs::directory_iterator(_prefix_cache, ec)) {
+    if (entry.is_regular_file(ec) && entry.path().extension() == ".kv") {
+      entries.emplace_back(entry.last_write_time(ec), entry.path());
+    }
+  }
+  if (entries.size() > PREFIX_CACHE_MAX) {
+    // newest first, each restore or save refreshes the time
+    std::sort(entries.begin(), entries.end(), [](const auto &a, const auto &b) { return a.first > b.first; });
+    for (size_t i = PREFIX_CACHE_MAX; i < entries.size(); i++) {
+      fs::remove(entries[i].second, ec);
+    }
+  }
+}
+
+bool Llama::save_state(const string &path, llama_seq_id seq) {
+  halt();
+  if (!valid_seq(seq)) {
+    return false;
+  }
+  LlamaSeq &state = _seqs[seq];
+  size_t n_state = llama_state_seq_get_size(_ctx, seq);
+  vector<uint8_t> data(n_state);
+  if (llama_state_seq_get_data(_ctx, data.data(), n_state, seq) != n_state) {
+    set_last_error("Read sequence state");
+    return false;
+  }
+
+  LlamaStateHeader header = {};
+  memcpy(header.magic, STATE_MAGIC, sizeof(header.magic));
+  header.version = STATE_VERSION;
+  header.model_hash = model_hash();
+  header.n_tokens = state._tokens.size();
+  header.n_system_tokens = state._n_system_tokens;
+  header.n_state = n_state;
+
+  FILE *fp = fopen(path.c_str(), "wb");
+  if (!fp) {
+    set_last_error(std::format("Open {}", path));
+    return false;
+  }
+  bool ok = (fwrite(&header, sizeof(header), 1, fp) == 1 &&
+             fwrite(state._tokens.data(), sizeof(llama_token), state._tokens.size(), fp) == state._tokens.size() &&
+             fwrite(data.data(), 1, n_state, fp) == n_state);
+  if (fclose(fp) != 0 || !ok) {
+    remove(path.c_str());
+    set_last_error(std::format("Write {}", path));
+    return false;
+  }
+  return true;
+}
+
+bool Llama::load_state(const string &path, llama_seq_id seq) {
+  halt();
+  if (!valid_seq(seq)) {
+    return false;
+  }
+  FILE *fp = fopen(path.c_str(), "rb");
+  if (!fp) {
+    set_last_error(std::format("Open {}", path));
+    return false;
+  }
+
+  std::error_code ec;
+  uint64_t file_size = std::filesystem::file_size(path, ec);
+  LlamaStateHeader header;
+  vector<llama_token> tokens;
+  vector<uint8_t> data;
+  bool ok = !ec && fread(&header, sizeof(header), 1, fp) == 1;
+  if (ok && (memcmp(header.magic, STATE_MAGIC, sizeof(header.magic)) != 0 || header.version != STATE_VERSION)) {
+    set_last_error(std::format("Unrecognised state file {}", path));
+    ok = false;
+  } else if (ok && header.model_hash != model_hash()) {
+    set_last_error(std::format("State file {} was saved with a different model or context size", path));
+    ok = false;
+  } else if (ok && (header.n_tokens > llama_n_ctx(_ctx) || header.n_system_tokens > header.n_tokens ||
+                     header.n_tokens * sizeof(llama_token) > file_size - sizeof(header) ||
+                     header.n_state != file_size - sizeof(header) - header.n_tokens * sizeof(llama_token))) {
+    // the state blob fills the rest of the file, so a truncated file can't demand a huge buffer
+    set_last_error(std::format("Corrupt state file {}", path));
+    ok = false;
+  } else if (ok) {
+    tokens.resize(header.n_tokens);
+    data.resize(header.n_state);
+    ok = (fread(tokens.data(), sizeof(llama_token), tokens.size(), fp) == tokens.size() &&
+          fread(data.data(), 1, data.size(), fp) == data.size());
+    if (!ok) {
+      set_last_error(std::format("Read {}", path));
+    }
+  }
+  fclose(fp);
+
+  if (ok) {
+    reset_seq(seq);
+    if (llama_state_seq_set_data(_ctx, data.data(), data.size(), seq) != data.size()) {
+      reset_seq(seq);
+      set_last_error("Restore sequence state");
+      ok = false;
+    } else {
+      LlamaSeq &state = _seqs[seq];
+      state._tokens = std::move(tokens);
+      state._n_past = state._tokens.size();
+      state._n_system_tokens = header.n_system_tokens;
+      // logits are not part of the snapshot, restore_logits re-decodes the final token on demand
+    }
+  }
+  return ok;
+}
+
 vector<llama_token> Llama::tokenize(const string &prompt) {
   vector<llama_token> result;
 
@@ -674,6 +1707,28 @@ vector<llama_token> Llama::tokenize(const string &prompt) {
   return result;
 }
 
+int Llama::count_tokens(const string &text) {
+  int result = 0;
+  if (_vocab != nullptr && !text.empty()) {
+    // a negative result is the number of tokens that did not fit
+    result = -llama_tokenize(_vocab, text.c_str(), text.size(), nullptr, 0, false, true);
+  }
+  return std::max(result, 0);
+}
+
+uint64_t Llama::vocab_hash() {
+  uint64_t result = 14695981039346656037ull;
+  if (_vocab != nullptr) {
+    int32_t n_tokens = llama_vocab_n_tokens(_vocab);
+    result = fnv1a(result, &n_tokens, sizeof(n_tokens));
+    for (llama_token tok = 0; tok < n_tokens; tok++) {
+      const char *text = llama_vocab_get_text(_vocab, tok);
+      result = fnv1a(result, text, strlen(text) + 1);
+    }
+  }
+  return result;
+}
+
 string Llama::token_to_string(LlamaIter &iter, llama_token tok) {
   string result;
   char buf[512];
@@ -728,20 +1783,23 @@ void Llama::set_last_error(const string &message) {
   }
 }
 
-void Llama::set_decode_error(int32_t error, int index, int num_tokens) {
+void Llama::set_decode_error(llama_seq_id seq, int32_t error, int index, int num_tokens) {
   if (error == 1) {
-    llama_memory_t mem = llama_get_memory(_ctx);
-    llama_pos pos_min = llama_memory_seq_pos_min(mem, 0);
-    llama_pos pos_max = llama_memory_seq_pos_max(mem, 0);
     int n_ctx = llama_n_ctx(_ctx);
-    int current_used = pos_max - pos_min + 1;
     int space_needed = num_tokens;
-    int space_available = n_ctx - current_used;
-    _n_system_tokens;
-    set_last_error(std::format("KV exhausted. Reduce batch or context sizes. batchNo:{} requested:{} available:{}",
-                               index, space_needed, space_available));
+    int space_available = n_ctx - kv_used();
+    set_last_error(std::format("KV exhausted. Reduce batch or context sizes. seq:{} batchNo:{} requested:{} available:{}",
+                               seq, index, space_needed, space_available));
   } else {
     auto message = error == 2 ? "abort" : error == -1 ? "invalid" : "fatal";
     set_last_error(std::format("Failed to decode batch. batchNo:{} error:'{}'", index, message));
   }
 }
+
+bool Llama::valid_seq(llama_seq_id seq) {
+  bool result = (seq >= 0 && seq < (llama_seq_id)_seqs.size());
+  if (!result) {
+    set_last_error(std::format("Invalid sequence {}, expected 0 to {}", seq, (int)_seqs.size() - 1));
+  }
+  return result;
+}
@@ -7,7 +7,10 @@
 
 #pragma once
 
+#include <atomic>
 #include <chrono>
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 #include "llama.h"
@@ -15,6 +18,7 @@
 using namespace std;
 
 struct Llama;
+struct LlamaAsync;
 struct RagDB;
 struct RagSession;
 
@@ -39,9 +43,28 @@ struct LlamaMemoryInfo {
   string  advice;
 };
 
+//
+// per-conversation state, each sequence owns a llama_seq_id within the shared KV cache
+//
+struct LlamaSeq {
+  LlamaSeq();
+
+  llama_sampler *_sampler;
+  // tokens held in the KV cache for this sequence, in position order
+  vector<llama_token> _tokens;
+  // length of the current conversation within _tokens, any remainder was left by reset()
+  // and is reused when add_message sends the same tokens again
+  size_t _n_past;
+  // decode serial number and batch index holding this sequence's latest logits
+  uint64_t _logits_decode;
+  int _logits_index;
+  int _n_system_tokens;
+  bool _sampler_dirty;
+};
+
 struct LlamaIter {
   explicit LlamaIter();
-  ~LlamaIter() {}
+  ~LlamaIter();
 
   // move constructor
   LlamaIter(LlamaIter &&other) noexcept;
@@ -51,11 +74,21 @@ struct LlamaIter {
   LlamaIter &operator=(const LlamaIter &) = delete;
 
   Llama *_llama;
+  llama_seq_id _seq_id;
+  // speculative decoding: drafted tokens already verified and decoded, followed by a
+  // sampled token that is still to be decoded
+  vector<llama_token> _accepted;
+  llama_token _next_token;
   string _last_word;
   chrono::high_resolution_clock::time_point _t_start;
   int _repetition_count;
-  int _tokens_generated;
+  // tokens decoded for the response, including verified drafts not yet returned
+  uint32_t _n_decoded;
+  // written by the generation thread while the iterator runs asynchronously
+  std::atomic<int> _tokens_generated;
   bool _has_next;
+  // generation thread and the ring buffer of pieces it produces, set between start() and stop()
+  std::unique_ptr<LlamaAsync> _async;
 };
 
 struct Llama {
@@ -71,17 +104,41 @@ struct Llama {
   ~Llama();
 
   // init
-  bool load_model(string model_path, int n_ctx, int n_batch, int n_gpu_layers, int log_level);
+  bool load_model(string model_path, int n_ctx, int n_batch, int n_gpu_layers, int log_level, int n_seq = 1);
   bool load_embedding_model(string model_path);
 
+  // speculative decoding, the draft model proposes n_draft tokens for the main model to verify
+  bool load_draft_model(string model_path, int n_draft);
+
   // generation
-  bool add_message(LlamaIter &iter, const string &role, const string &content);
+  bool add_message(LlamaIter &iter, const string &role, const string &content, llama_seq_id seq = 0);
   string next(LlamaIter &iter);
   string all(LlamaIter &iter);
 
+  // asynchronous generation, a worker thread samples and decodes while the caller polls for
+  // the pieces it produced. next() then returns an empty string when no piece is ready. one
+  // iterator runs at a time, any other call that uses the model stops it first. stop() removes
+  // the tokens behind pieces that were not taken
+  bool start(LlamaIter &iter);
+  bool has_next(const LlamaIter &iter) const;
+  bool try_next(LlamaIter &iter, string &out);
+  void stop(LlamaIter &iter);
+
+  // advances each iterator by one token using a single decode, iterators must use distinct sequences
+  bool next_batch(const vector<LlamaIter *> &iters, vector<string> &out);
+
+  // sequences
+  int n_seq() const { return (int)_seqs.size(); }
+  bool reset_seq(llama_seq_id seq);
+
+  // KV cache snapshots, the prefix cache directory holds snapshots of decoded system prompts
+  bool save_state(const string &path, llama_seq_id seq = 0);
+  bool load_state(const string &path, llama_seq_id seq = 0);
+  void set_prefix_cache(const string &dir) { halt(); _prefix_cache = dir; }
+
   // generation parameters
-  void add_stop(const char *stop) { _stop_sequences.push_back(stop); }
-  void clear_stops() { _stop_sequences.clear(); }
+  void add_stop(const char *stop) { halt(); _stop_sequences.push_back(stop); }
+  void clear_stops() { halt(); _stop_sequences.clear(); }
   void set_penalty_last_n(int32_t penalty_last_n) { _penalty_last_n = penalty_last_n; dirty(); }
   void set_penalty_repeat(float penalty_repeat) { _penalty_repeat = penalty_repeat; dirty(); }
   void set_penalty_freq(float penalty_freq) { _penalty_freq = penalty_freq; dirty(); }
@@ -95,8 +152,8 @@ struct Llama {
   void set_seed(unsigned int seed) { _seed = seed; dirty(); }
 
   // error handling
-  const char *last_error() { return _last_error.c_str(); }
-  void set_log_level(int level) { _log_level = level; }
+  const char *last_error() { halt(); return _last_error.c_str(); }
+  void set_log_level(int level) { halt(); _log_level = level; }
   void reset();
   int max_tool_result_size();
   bool is_memory_flush();
@@ -105,38 +162,80 @@ struct Llama {
   LlamaMemoryInfo memory_info();
   float memory_kv_percent();
 
+  // number of tokens in the text, without the BOS token
+  int count_tokens(const string &text);
+
+  // identifies the vocabulary, equal for models that tokenize alike
+  uint64_t vocab_hash();
+
+  // identifies the loaded model file and context size, as recorded in KV snapshots
+  uint64_t model_hash();
+
   // creates an embedding vector of the given dimension for the given text
   bool embed_text(const std::string &text, std::vector<float> &out, int embed_dim);
 
+  // creates embeddings for several texts, packing them into one decode as separate sequences
+  bool embed_batch(const vector<string> &texts, vector<vector<float>> &out, int embed_dim);
+
   // retrieves rag query context informatiion from the rag database
   std::string rag_retrieve(const RagDB &db, const std::string &query, int top_k, RagSession &session);
 
   // indexes the details from the given file
   bool rag_index(RagDB &db, const std::string &filepath);
 
+  // indexes the files, chunking on worker threads while this thread embeds. progress
+  // is called from this thread with the number of files indexed so far
+  bool rag_index(RagDB &db, const vector<string> &filepaths,
+                 const std::function<void(size_t done, size_t total)> &progress = nullptr);
+
   //  returns the emdedding dimension for the loaded model
   int get_embed_dim() const { return _model != nullptr ? llama_model_n_embd(_model) : 0; }
 
   private:
-  bool batch_decode_tokens(vector<llama_token> &tokens);
-  bool configure_sampler();
-  void dirty() {_sampler_dirty = true; }
-  bool full_flush_except_system();
-  bool make_space_for_tokens(int n_tokens);
+  bool batch_decode_tokens(llama_seq_id seq, vector<llama_token> &tokens);
+  void generate(LlamaIter &iter);
+  bool draft(llama_seq_id seq, llama_token tok, int n_draft, vector<llama_token> &drafted);
+  bool configure_sampler(LlamaSeq &state);
+  int32_t decode_seq(llama_seq_id seq, const llama_token *tokens, int n_tokens);
+  void dirty();
+  void halt();
+  bool full_flush_except_system(llama_seq_id seq);
+  bool truncate_seq(llama_seq_id seq, size_t n_tokens);
+  int kv_used();
+  bool make_space_for_tokens(llama_seq_id seq, int n_tokens);
+  string prefix_cache_path(const vector<llama_token> &tokens);
+  void trim_prefix_cache();
+  bool restore_logits(llama_seq_id seq);
+  size_t reuse_prefix(llama_seq_id seq, const vector<llama_token> &tokens);
+  llama_token sample(llama_seq_id seq);
+  bool step(LlamaIter &iter, string &out);
+  llama_token speculate(llama_seq_id seq, llama_token tok, int n_max, vector<llama_token> &accepted);
   vector<llama_token> tokenize(const string &prompt);
   string token_to_string(LlamaIter &iter, llama_token tok);
   void set_last_error(const string &message);
-  void set_decode_error(int32_t error, int index, int num_tokens);
+  void set_decode_error(llama_seq_id seq, int32_t error, int index, int num_tokens);
+  bool valid_seq(llama_seq_id seq);
 
   llama_model *_model;
   llama_context *_ctx;
-  llama_sampler *_sampler;
   const llama_vocab *_vocab;
+  vector<LlamaSeq> _seqs;
+  llama_batch _batch;
+  uint64_t _n_decode;
+  // identity of the loaded model file, see model_hash()
+  uint64_t _model_file;
   vector<string> _stop_sequences;
   string _grammar_src;
   string _grammar_root;
   string _last_error;
   string _template;
+  string _prefix_cache;
+  llama_model *_draft_model;
+  llama_context *_draft_ctx;
+  llama_batch _draft_batch;
+  // tokens held in the draft KV cache for each sequence, positions match their index
+  vector<vector<llama_token>> _draft_tokens;
+  int _n_draft;
   int32_t _penalty_last_n;
   float _penalty_repeat;
   float _penalty_freq;
@@ -148,10 +247,12 @@ struct Llama {
   int _max_tokens;
   int _log_level;
   int _n_gpu_layers;
-  int _n_system_tokens;
   bool _is_gemma4;
-  bool _sampler_dirty;
   bool _can_shift;
+  // whether the memory supports removing the tail of a sequence
+  bool _can_truncate;
   bool _memory_flush;
   unsigned int _seed;
+  // iterator generating on a worker thread, set by start() and cleared by stop()
+  LlamaIter *_async_iter;
 };
@@ -353,7 +353,8 @@ static int cmd_llama_has_next(var_s *self, int argc, slib_par_t *arg, var_s *ret
     int id = get_llama_iter_class_id(self, retval);
     if (id != -1) {
       LlamaIter &llamaIter = g_llama_iter.at(id);
-      v_setint(retval, llamaIter._has_next);
+      // the llama may already be freed once the iterator is no longer generating
+      v_setint(retval, llamaIter._async ? llamaIter._llama->has_next(llamaIter) : llamaIter._has_next);
       result = 1;
     }
   }
@@ -379,6 +380,67 @@ static int cmd_llama_next(var_s *self, int argc, slib_par_t *arg, var_s *retval)
   return result;
 }
 
+//
+// iter.start() - generate on a background thread, next() then returns "" until a token is ready
+//
+static int cmd_llama_start(var_s *self, int argc, slib_par_t *arg, var_s *retval) {
+  int result = 0;
+  if (argc != 0) {
+    error(retval, "iter.start", 0, 0);
+  } else {
+    int id = get_llama_iter_class_id(self, retval);
+    if (id != -1) {
+      LlamaIter &iter = g_llama_iter.at(id);
+      if (iter._llama->start(iter)) {
+        result = 1;
+      } else {
+        error(retval, iter._llama->last_error());
+      }
+    }
+  }
+  return result;
+}
+
+//
+// while iter.has_next() : tok = iter.try_next() : wend - returns "" when no token is ready yet
+//
+static int cmd_llama_try_next(var_s *self, int argc, slib_par_t *arg, var_s *retval) {
+  int result = 0;
+  if (argc != 0) {
+    error(retval, "iter.try_next", 0, 0);
+  } else {
+    int id = get_llama_iter_class_id(self, retval);
+    if (id != -1) {
+      LlamaIter &iter = g_llama_iter.at(id);
+      string out;
+      iter._llama->try_next(iter, out);
+      v_setstr(retval, out.c_str());
+      result = 1;
+    }
+  }
+  return result;
+}
+
+//
+// iter.stop() - ends background generation, the tokens not yet taken are removed from the conversation
+//
+static int cmd_llama_stop(var_s *self, int argc, slib_par_t *arg, var_s *retval) {
+  int result = 0;
+  if (argc != 0) {
+    error(retval, "iter.stop", 0, 0);
+  } else {
+    int id = get_llama_iter_class_id(self, retval);
+    if (id != -1) {
+      LlamaIter &iter = g_llama_iter.at(id);
+      if (iter._async) {
+        iter._llama->stop(iter);
+      }
+      result = 1;
+    }
+  }
+  return result;
+}
+
 //
 // iter.tokens_sec
 //
@@ -402,11 +464,12 @@ static int cmd_llama_tokens_sec(var_s *self, int argc, slib_par_t *arg, var_s *r
 
 //
 // print llama.add_message("please generate as simple program in BASIC to draw a cat")
+// iter = llama.add_message("user", "hello", 1) - continue the conversation held in sequence 1
 //
 static int cmd_llama_add_message(var_s *self, int argc, slib_par_t *arg, var_s *retval) {
   int result = 0;
-  if (argc != 2) {
-    error(retval, "llama.add_message", 2, 2);
+  if (argc < 2 || argc > 3) {
+    error(retval, "llama.add_message", 2, 3);
   } else {
     int id = get_llama_class_id(self, retval);
     if (id != -1) {
@@ -415,11 +478,16 @@ static int cmd_llama_add_message(var_s *self, int argc, slib_par_t *arg, var_s *
       Llama &llama = g_llama.at(id);
       auto role = get_param_str(argc, arg, 0, "user");
       auto content = get_param_str(argc, arg, 1, "");
-      if (llama.add_message(iter, role, content)) {
+      auto seq = get_param_int(argc, arg, 2, 0);
+      if (llama.add_message(iter, role, content, seq)) {
         map_init_id(retval, iter_id, CLASS_ID_LLAMA_ITER);
+        v_setint(map_add_var(retval, "seq", 0), seq);
         v_create_callback(retval, "all", cmd_llama_all);
         v_create_callback(retval, "has_next", cmd_llama_has_next);
         v_create_callback(retval, "next", cmd_llama_next);
+        v_create_callback(retval, "start", cmd_llama_start);
+        v_create_callback(retval, "stop", cmd_llama_stop);
+        v_create_callback(retval, "try_next", cmd_llama_try_next);
         v_create_callback(retval, "tokens_sec", cmd_llama_tokens_sec);
         result = 1;
       } else {
@@ -431,6 +499,152 @@ static int cmd_llama_add_message(var_s *self, int argc, slib_par_t *arg, var_s *
   return result;
 }
 
+//
+// out = llama.next_batch(iter1, iter2) - one decode step shared by each conversation
+//
+static int cmd_llama_next_batch(var_s *self, int argc, slib_par_t *arg, var_s *retval) {
+  int result = 0;
+  if (argc < 1) {
+    error(retval, "llama.next_batch: expected one or more iterators");
+  } else {
+    int id = get_llama_class_id(self, retval);
+    if (id != -1) {
+      Llama &llama = g_llama.at(id);
+      vector<LlamaIter *> iters;
+      for (int i = 0; i < argc; i++) {
+        int iter_id = get_llama_iter_class_id(arg[i].var_p, retval);
+        if (iter_id == -1) {
+          break;
+        }
+        LlamaIter &iter = g_llama_iter.at(iter_id);
+        if (iter._llama != &llama) {
+          error(retval, "llama.next_batch: iter belongs to another llama");
+          break;
+        }
+        iters.push_back(&iter);
+      }
+      vector<string> out;
+      if ((int)iters.size() != argc) {
+        // error already reported
+      } else if (llama.next_batch(iters, out)) {
+        v_toarray1(retval, out.size());
+        for (size_t i = 0; i < out.size(); i++) {
+          v_setstr(v_elem(retval, i), out[i].c_str());
+        }
+        result = 1;
+      } else {
+        error(retval, llama.last_error());
+      }
+    }
+  }
+  return result;
+}
+
+//
+// llama.reset_seq(1) - forget the conversation held in the given sequence
+//
+static int cmd_llama_reset_seq(var_s *self, int argc, slib_par_t *arg, var_s *retval) {
+  int result = 0;
+  if (argc != 1) {
+    error(retval, "llama.reset_seq", 1, 1);
+  } else {
+    int id = get_llama_class_id(self, retval);
+    if (id != -1) {
+      Llama &llama = g_llama.at(id);
+      if (llama.reset_seq(get_param_int(argc, arg, 0, 0))) {
+        result = 1;
+      } else {
+        error(retval, llama.last_error());
+      }
+    }
+  }
+  return result;
+}
+
+//
+// llama.save_session("chat.kv") - write the KV cache for sequence 0 (or the given sequence)
+//
+static int cmd_llama_save_session(var_s *self, int argc, slib_par_t *arg, var_s *retval) {
+  int result = 0;
+  if (argc < 1 || argc > 2) {
+    error(retval, "llama.save_session", 1, 2);
+  } else {
+    int id = get_llama_class_id(self, retval);
+    if (id != -1) {
+      Llama &llama = g_llama.at(id);
+      auto path = expand_path(get_param_str(argc, arg, 0, ""));
+      if (llama.save_state(path, get_param_int(argc, arg, 1, 0))) {
+        result = 1;
+      } else {
+        error(retval, llama.last_error());
+      }
+    }
+  }
+  return result;
+}
+
+//
+// llama.load_session("chat.kv") - restore a KV cache written by save_session
+//
+static int cmd_llama_load_session(var_s *self, int argc, slib_par_t *arg, var_s *retval) {
+  int result = 0;
+  if (argc < 1 || argc > 2) {
+    error(retval, "llama.load_session", 1, 2);
+  } else {
+    int id = get_llama_class_id(self, retval);
+    if (id != -1) {
+      Llama &llama = g_llama.at(id);
+      auto path = expand_path(get_param_str(argc, arg, 0, ""));
+      if (llama.load_state(path, get_param_int(argc, arg, 1, 0))) {
+        result = 1;
+      } else {
+        error(retval, llama.last_error());
+      }
+    }
+  }
+  return result;
+}
+
+//
+// llama.set_prefix_cache("~/.cache/kv") - reuse decoded system prompts across runs
+//
+static int cmd_llama_set_prefix_cache(var_s *self, int argc, slib_par_t *arg, var_s *retval) {
+  int result = 0;
+  if (argc != 1) {
+    error(retval, "llama.set_prefix_cache", 1, 1);
+  } else {
+    int id = get_llama_class_id(self, retval);
+    if (id != -1) {
+      Llama &llama = g_llama.at(id);
+      llama.set_prefix_cache(expand_path(get_param_str(argc, arg, 0, "")));
+      result = 1;
+    }
+  }
+  return result;
+}
+
+//
+// llama.load_draft_model("small.gguf", 8) - speculative decoding with a smaller model sharing the vocabulary
+//
+static int cmd_llama_load_draft_model(var_s *self, int argc, slib_par_t *arg, var_s *retval) {
+  int result = 0;
+  if (argc < 1 || argc > 2) {
+    error(retval, "llama.load_draft_model", 1, 2);
+  } else {
+    int id = get_llama_class_id(self, retval);
+    if (id != -1) {
+      Llama &llama = g_llama.at(id);
+      auto path = expand_path(get_param_str(argc, arg, 0, ""));
+      if (llama.load_draft_model(path, get_param_int(argc, arg, 1, 8))) {
+        result = 1;
+      } else {
+        error(retval, llama.last_error());
+      }
+    }
+  }
+  return result;
+}
+
 //
 // print llama.mem_info()
 //
@@ -467,13 +681,20 @@ static int cmd_create_llama(int argc, slib_par_t *params, var_t *retval) {
   auto n_batch = get_param_int(argc, params, 2, 1024);
   auto n_gpu_layers = get_param_int(argc, params, 3, -1);
   auto n_log_level = get_param_int(argc, params, 4, GGML_LOG_LEVEL_CONT);
+  auto n_seq = get_param_int(argc, params, 5, 1);
   int id = ++g_nextId;
   Llama &llama = g_llama[id];
-  if (llama.load_model(model, n_ctx, n_batch, n_gpu_layers, n_log_level)) {
+  if (llama.load_model(model, n_ctx, n_batch, n_gpu_layers, n_log_level, n_seq)) {
     map_init_id(retval, id, CLASS_ID_LLAMA);
     v_create_callback(retval, "add_stop", cmd_llama_add_stop);
     v_create_callback(retval, "add_message", cmd_llama_add_message);
+    v_create_callback(retval, "next_batch", cmd_llama_next_batch);
     v_create_callback(retval, "reset", cmd_llama_reset);
+    v_create_callback(retval, "reset_seq", cmd_llama_reset_seq);
+    v_create_callback(retval, "save_session", cmd_llama_save_session);
+    v_create_callback(retval, "load_session", cmd_llama_load_session);
+    v_create_callback(retval, "set_prefix_cache", cmd_llama_set_prefix_cache);
+    v_create_callback(retval, "load_draft_model", cmd_llama_load_draft_model);
     v_create_callback(retval, "set_penalty_repeat", cmd_llama_set_penalty_repeat);
     v_create_callback(retval, "set_penalty_freq", cmd_llama_set_penalty_freq);
     v_create_callback(retval, "set_penalty_present", cmd_llama_set_penalty_present);
@@ -496,7 +717,7 @@ static int cmd_create_llama(int argc, slib_par_t *params, var_t *retval) {
 }
 
 FUNC_SIG lib_func[] = {
-  {1, 5, "LLAMA", cmd_create_llama},
+  {1, 6, "LLAMA", cmd_create_llama},
 };
 
 SBLIB_API int sblib_func_count() {
@@ -571,14 +792,15 @@ SBLIB_API int sblib_refresh_id(int cls_id, int id) {
 // Program termination
 //
 void sblib_close(void) {
-  if (!g_llama.empty()) {
-    fprintf(stderr, "LLM leak detected\n");
-    g_llama.clear();
-  }
+  // iterators refer to their llama, so they go first
   if (!g_llama_iter.empty()) {
     fprintf(stderr, "LLM iter leak detected\n");
     g_llama_iter.clear();
   }
+  if (!g_llama.empty()) {
+    fprintf(stderr, "LLM leak detected\n");
+    g_llama.clear();
+  }
 }
 
 #if defined(ANDROID_MODULE)
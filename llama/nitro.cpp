@@ -47,6 +47,8 @@
 #include <random>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_set>
 #include <vector>
 
 #include "llama-sb.h"
@@ -62,11 +64,13 @@ namespace fs = std::filesystem;
 struct NitroConfig {
   std::string model_path;
   std::string embed_path;
+  std::string draft_path;
   std::string sandbox;
   std::string agent_id;
   int   n_ctx          = 65536;
   int   n_batch        = 512;
   int   n_gpu_layers   = 32;
+  int   n_draft        = 8;
   int   log_level      = GGML_LOG_LEVEL_CONT;
   float temperature    = 0.6f;
   float top_p          = 0.95f;
@@ -76,6 +80,15 @@ struct NitroConfig {
   int   penalty_last_n = 256;
   std::vector<std::string> knowledge_files;
   int   rag_top_k      = 5;
+  // embedding storage for saved indexes: none, int8 or binary
+  std::string rag_quant  = "none";
+  // retrieval ranking: fused (cosine and BM25) or vector (cosine only)
+  std::string rag_rank   = "fused";
+  // query embeddings kept per session (0 disables), saved beside the index when persisted
+  int   rag_cache      = 256;
+  // IVF lists probed per query for large indexes, 0 scans exactly without an IVF
+  int   rag_probe      = 0;
+  bool  rag_cache_persist = true;
   bool  thinking       = true;
   bool  permission_prompt = false;
   // TOOL:RUN allowlist — if non-empty, only these program basenames may run.
@@ -291,13 +304,19 @@ struct AgentState {
   std::unique_ptr<Llama> embed_llama;
   std::unique_ptr<RagDB> rag_db;
   std::unique_ptr<RagSession> rag_session;
+  // identifies the embedding model whose query embeddings are cached
+  uint64_t embed_model_id = 0;
+  // vocabulary of the generation model, whose token counts are stored with the index
+  uint64_t vocab_id = 0;
   bool model_loaded = false;
   std::string system_prompt;
 
   bool rag_index(const std::string &path, const NitroConfig &cfg, TuiState &tui) const;
   bool rag_load_index(const std::string &path, TuiState &tui) const;
   bool run_turn(const std::string &user_message, const NitroConfig &cfg, TuiState &tui);
-  bool setup_embed(const std::string &path, TuiState &tui);
+  bool setup_embed(const std::string &path, const NitroConfig &cfg, TuiState &tui);
+  void save_query_cache(const NitroConfig &cfg) const;
+  void rag_budget(int reserve) const;
   bool setup_model(const NitroConfig &cfg, TuiState &tui);
   void apply_generation_params(const NitroConfig &cfg) const;
   void reset_conversation(const std::string &sysprompt, TuiState &tui);
@@ -443,6 +462,13 @@ static std::string settings_path() {
   return base + "/.config/nitro/settings.json";
 }
 
+// Returns the KV snapshot directory: ~/.config/nitro/kvcache
+static std::string kv_cache_path() {
+  const char *home = getenv("HOME");
+  std::string base = home ? std::string(home) : ".";
+  return base + "/.config/nitro/kvcache";
+}
+
 // Returns the history file path: ~/.config/nitro/history.txt
 static std::string history_path() {
   const char *home = getenv("HOME");
@@ -557,15 +583,25 @@ static void load_settings(NitroConfig &cfg) {
   // String fields
   settings_get_str(json, "model_path",  cfg.model_path);
   settings_get_str(json, "embed_path",  cfg.embed_path);
+  settings_get_str(json, "draft_path",  cfg.draft_path);
   settings_get_str(json, "sandbox",     cfg.sandbox);
+  settings_get_str(json, "rag_quant",   cfg.rag_quant);
+  settings_get_str(json, "rag_rank",    cfg.rag_rank);
 
   // Integer fields
   settings_get_int(json, "n_ctx",          cfg.n_ctx);
   settings_get_int(json, "n_batch",        cfg.n_batch);
   settings_get_int(json, "n_gpu_layers",   cfg.n_gpu_layers);
+  settings_get_int(json, "n_draft",        cfg.n_draft);
   settings_get_int(json, "top_k",          cfg.top_k);
   settings_get_int(json, "penalty_last_n", cfg.penalty_last_n);
   settings_get_int(json, "rag_top_k",      cfg.rag_top_k);
+  settings_get_int(json, "rag_cache",      cfg.rag_cache);
+  settings_get_int(json, "rag_probe",      cfg.rag_probe);
+  int rag_cache_persist = cfg.rag_cache_persist;
+  if (settings_get_int(json, "rag_cache_persist", rag_cache_persist)) {
+    cfg.rag_cache_persist = rag_cache_persist != 0;
+  }
 
   // Float fields
   settings_get_float(json, "temperature",    cfg.temperature);
@@ -587,32 +623,46 @@ static std::string introspect(const NitroConfig &cfg) {
     "{{\n"
     "  \"model_path\":     \"{}\",\n"
     "  \"embed_path\":     \"{}\",\n"
+    "  \"draft_path\":     \"{}\",\n"
     "  \"sandbox\":        \"{}\",\n"
     "  \"n_ctx\":          {},\n"
     "  \"n_batch\":        {},\n"
     "  \"n_gpu_layers\":   {},\n"
+    "  \"n_draft\":        {},\n"
     "  \"temperature\":    {},\n"
     "  \"top_p\":          {},\n"
     "  \"min_p\":          {},\n"
     "  \"top_k\":          {},\n"
     "  \"penalty_repeat\": {},\n"
     "  \"penalty_last_n\": {},\n"
-    "  \"rag_top_k\":      {}\n"
+    "  \"rag_top_k\":      {},\n"
+    "  \"rag_quant\":      \"{}\",\n"
+    "  \"rag_rank\":       \"{}\",\n"
+    "  \"rag_cache\":      {},\n"
+    "  \"rag_probe\":      {},\n"
+    "  \"rag_cache_persist\": {:d}\n"
     "}}\n";
   return std::format(tmpl,
                      cfg.model_path,
                      cfg.embed_path,
+                     cfg.draft_path,
                      cfg.sandbox,
                      cfg.n_ctx,
                      cfg.n_batch,
                      cfg.n_gpu_layers,
+                     cfg.n_draft,
                      cfg.temperature,
                      cfg.top_p,
                      cfg.min_p,
                      cfg.top_k,
                      cfg.penalty_repeat,
                      cfg.penalty_last_n,
-                     cfg.rag_top_k);
+                     cfg.rag_top_k,
+                     cfg.rag_quant,
+                     cfg.rag_rank,
+                     cfg.rag_cache,
+                     cfg.rag_probe,
+                     cfg.rag_cache_persist);
 }
 
 // Persist the current cfg to ~/.config/nitro/settings.json.
@@ -769,6 +819,13 @@ static std::string join_path(const std::string &a, const std::string &b) {
   return pa + "/" + pb;
 }
 
+// true when file is root or lies beneath it, comparing whole path components so
+// that src2/a.c is not within src and foo.hpp is not foo.h
+static bool path_within(const fs::path &file, const fs::path &root) {
+  fs::path relative = file.lexically_normal().lexically_relative(root.lexically_normal());
+  return !relative.empty() && *relative.begin() != "..";
+}
+
 static std::string read_file(const std::string &path) {
   std::ifstream f(path, std::ios::binary);
   if (!f) {
@@ -1514,7 +1571,8 @@ void TuiState::show_help() {
   append_line(ICON_SYS + "  exit / quit              exit Nitro");
   append_line(ICON_SYS + "Settable keys (via /set):");
   append_line(ICON_SYS + "  temperature  top_p  top_k  min_p  penalty_repeat");
-  append_line(ICON_SYS + "  penalty_last_n  rag_top_k  n_gpu_layers");
+  append_line(ICON_SYS + "  penalty_last_n  rag_top_k  rag_quant  rag_rank  n_gpu_layers");
+  append_line(ICON_SYS + "  rag_cache  rag_cache_persist (0 or 1)  rag_probe");
   append_line(ICON_SYS + "  run_allowed  (comma-separated list, e.g. python3,make)");
   redraw_all();
 }
@@ -1925,8 +1983,18 @@ bool AgentState::setup_model(const NitroConfig &cfg, TuiState &tui) {
     tui.redraw_all();
     return false;
   }
+  if (!cfg.draft_path.empty() && !llama->load_draft_model(cfg.draft_path, cfg.n_draft)) {
+    // generation still works without speculation
+    tui.append_line(ICON_ERR + llama->last_error());
+  }
+  // reuse the decoded system prompt across restarts and /clear
+  std::error_code ec;
+  if (fs::create_directories(kv_cache_path(), ec) || fs::is_directory(kv_cache_path(), ec)) {
+    llama->set_prefix_cache(kv_cache_path());
+  }
   tui.dismiss_modal_popup();
   model_loaded = true;
+  vocab_id = llama->vocab_hash();
   tui.current_model = model_name;
   tui.append_line(ICON_SYS + "Model ready: " + tui.current_model);
   LlamaMemoryInfo mem = llama->memory_info();
@@ -1940,7 +2008,8 @@ bool AgentState::setup_model(const NitroConfig &cfg, TuiState &tui) {
   return true;
 }
 
-bool AgentState::setup_embed(const std::string &path, TuiState &tui) {
+bool AgentState::setup_embed(const std::string &path, const NitroConfig &cfg, TuiState &tui) {
+  save_query_cache(cfg);
   tui.show_modal_popup("Loading embedding model: " + fs::path(path).filename().string());
   tui.redraw_all();
   embed_llama = std::make_unique<Llama>();
@@ -1954,6 +2023,12 @@ bool AgentState::setup_embed(const std::string &path, TuiState &tui) {
   tui.dismiss_modal_popup();
   rag_db      = std::make_unique<RagDB>();
   rag_session = std::make_unique<RagSession>();
+  rag_session->queries.resize(std::max(cfg.rag_cache, 0));
+  embed_model_id = embed_llama->model_hash();
+  if (cfg.rag_cache_persist) {
+    rag_session->queries.load(join_path(cfg.sandbox, "rag-queries.bin"), embed_model_id,
+                              embed_llama->get_embed_dim());
+  }
   tui.append_line(ICON_SYS + "Embedding model ready.");
   tui.redraw_all();
   return true;
@@ -1970,6 +2045,15 @@ void AgentState::reset_conversation(const std::string &sysprompt, TuiState &tui)
   }
 }
 
+//
+// saves the cached query embeddings beside the index for the next session
+//
+void AgentState::save_query_cache(const NitroConfig &cfg) const {
+  if (cfg.rag_cache_persist && rag_session && rag_session->queries.size() != 0) {
+    rag_session->queries.save(join_path(cfg.sandbox, "rag-queries.bin"), embed_model_id);
+  }
+}
+
 float AgentState::tokens_per_sec() const {
   if (!iter) return 0.0f;
   auto now = std::chrono::high_resolution_clock::now();
@@ -1997,12 +2081,46 @@ std::string AgentState::memory_info_text() const {
   oss << "GPU layers: " << m.n_layers_gpu << " / " << m.n_layers_total << "\n";
   oss << "CPU layers: " << m.n_layers_cpu << "\n";
   oss << "Advice    : " << m.advice << "\n";
+  if (rag_session) {
+    const RagQueryCache &queries = rag_session->queries;
+    oss << "RAG cache : " << queries.hits() << " hits, " << queries.misses() << " misses  ("
+        << queries.size() << " / " << queries.capacity() << " queries)\n";
+  }
   return oss.str();
 }
 
+// tokens left for the tool result prefix, chat template and memory status around retrieved context
+static constexpr int RAG_TOOL_RESERVE = 64;
+
+// wait between polls for the next piece from the generation thread
+static constexpr auto TOKEN_POLL = std::chrono::milliseconds(2);
+
+//
+// maps the rag_rank setting to the retrieval ranking
+//
+static RagRank rag_rank(const std::string &name) {
+  return name == "vector" ? RAG_RANK_VECTOR : RAG_RANK_FUSED;
+}
+
+//
+// sizes the next retrieval to the free KV cache space, less reserve tokens for the text
+// sent with it, counting exactly with the generation model's vocabulary
+//
+void AgentState::rag_budget(int reserve) const {
+  if (model_loaded && rag_session) {
+    Llama *model = llama.get();
+    rag_session->vocab = vocab_id;
+    rag_session->count_tokens = [model](const std::string &text) { return model->count_tokens(text); };
+    rag_session->set_headroom(model->max_tool_result_size() - reserve);
+  }
+}
+
 std::string AgentState::rag_tool(const NitroConfig &cfg, const std::string &agent_query) const {
   std::string result;
   if (embed_llama && rag_db && rag_session) {
+    rag_session->rank = rag_rank(cfg.rag_rank);
+    rag_session->probe = cfg.rag_probe;
+    rag_budget(RAG_TOOL_RESERVE);
     result = embed_llama->rag_retrieve(*rag_db, agent_query, cfg.rag_top_k, *rag_session);
     if (result.empty()) {
       result = "RAG: no context found";
@@ -2028,6 +2146,21 @@ bool AgentState::rag_load_index(const std::string &path, TuiState &tui) const {
   return true;
 }
 
+//
+// maps the rag_quant setting to the saved index format
+//
+static RagQuant rag_quant(const std::string &name) {
+  RagQuant result;
+  if (name == "int8") {
+    result = RAG_QUANT_INT8;
+  } else if (name == "binary") {
+    result = RAG_QUANT_BINARY;
+  } else {
+    result = RAG_QUANT_NONE;
+  }
+  return result;
+}
+
 bool AgentState::rag_index(const std::string &path, const NitroConfig &cfg, TuiState &tui) const {
   if (!embed_llama || !rag_db) {
     tui.append_line(ICON_ERR + "Load an embedding model first: /embed <path>");
@@ -2035,34 +2168,86 @@ bool AgentState::rag_index(const std::string &path, const NitroConfig &cfg, TuiS
     return false;
   }
 
-  auto index_one = [&](const std::string &filepath) {
-    tui.append_line(ICON_SYS + "  indexing: " + filepath);
-    tui.redraw_all();
-    if (!embed_llama->rag_index(*rag_db, filepath)) {
-      tui.append_line(ICON_ERR + "rag_load: " + embed_llama->last_error());
-      tui.redraw_all();
-    }
-  };
-
-  // must be set before indexing
-  rag_db->embed_dim = embed_llama->get_embed_dim();
-
-  fs::path rp(path);
+  // paths are keyed in the form the index records them, whichever way they were typed
+  std::vector<std::string> files;
+  fs::path rp(RagDB::source_path(path));
   std::error_code ec;
   if (fs::is_directory(rp, ec)) {
     for (const auto &entry : fs::recursive_directory_iterator(rp, ec)) {
       if (entry.is_regular_file()) {
-        index_one(entry.path().string());
+        files.push_back(RagDB::source_path(entry.path().string()));
       }
     }
   } else {
-    index_one(path);
+    files.push_back(rp.string());
   }
 
+  // start from the saved index so that unchanged files are not embedded again
   std::string save_path = join_path(cfg.sandbox, "rag-index.bin");
-  tui.append_line(ICON_SYS + "saving index: " + save_path);
+  int embed_dim = embed_llama->get_embed_dim();
+  if (rag_db->empty() && fs::exists(save_path, ec)) {
+    rag_db->load(save_path);
+  }
+  if (rag_db->embed_dim != embed_dim || (!rag_db->empty() && rag_db->sources().empty())) {
+    // made by another embedding model, or before files were recorded
+    rag_db->clear();
+  }
+  // must be set before indexing
+  rag_db->embed_dim = embed_dim;
+
+  // drop the chunks of changed files and of files deleted from under the path
+  std::vector<std::string> changed;
+  for (const std::string &file : files) {
+    if (rag_db->changed(file)) {
+      changed.push_back(file);
+    }
+  }
+  std::unordered_set<std::string> listed(files.begin(), files.end());
+  std::unordered_set<std::string> stale(changed.begin(), changed.end());
+  int deleted = 0;
+  rag_db->remove_sources([&](const std::string &recorded) {
+    // indexes saved before sources were normalised hold the paths as typed
+    std::string source = RagDB::source_path(recorded);
+    bool result = stale.count(source) != 0;
+    if (!result && listed.count(source) == 0 && path_within(source, rp)) {
+      deleted++;
+      result = true;
+    }
+    return result;
+  });
+  tui.append_line(ICON_SYS + std::format("  {} unchanged, {} to index, {} deleted",
+                                         files.size() - changed.size(), changed.size(), deleted));
   tui.redraw_all();
-  rag_db->save(save_path);
+
+  // files are chunked in the background while earlier chunks are embedded
+  size_t reported = 0;
+  auto progress = [&](size_t done, size_t total) {
+    if (done - reported >= 32 || done == total) {
+      tui.append_line(ICON_SYS + std::format("  indexing: {} of {} files", done, total));
+      tui.redraw_all();
+      reported = done;
+    }
+  };
+  if (!changed.empty() && !embed_llama->rag_index(*rag_db, changed, progress)) {
+    tui.append_line(ICON_ERR + "rag_load: " + embed_llama->last_error());
+    tui.redraw_all();
+  }
+
+  // chunk sizes in the generation model's tokens let retrieval pack the context exactly
+  if (model_loaded) {
+    rag_db->count_tokens(vocab_id, [this](const std::string &text) { return llama->count_tokens(text); });
+  }
+
+  // indexes saved before BM25 ranking are saved again to add it, and the IVF is added or
+  // dropped to follow rag_probe
+  RagQuant quant = rag_quant(cfg.rag_quant);
+  bool ann = cfg.rag_probe > 0 && rag_db->size() >= RAG_ANN_MIN;
+  if (rag_db->dirty() || rag_db->quant() != quant || (!rag_db->empty() && rag_db->lexical().empty()) ||
+      ann == rag_db->ann().empty()) {
+    tui.append_line(ICON_SYS + "saving index: " + save_path);
+    tui.redraw_all();
+    rag_db->save(save_path, quant, ann);
+  }
 
   return true;
 }
@@ -2251,6 +2436,9 @@ bool AgentState::run_turn(const std::string &user_message, const NitroConfig &cf
   }
   std::string effective_message = user_message;
   if (embed_llama && rag_db && rag_session) {
+    rag_session->rank = rag_rank(cfg.rag_rank);
+    rag_session->probe = cfg.rag_probe;
+    rag_budget(llama->count_tokens(user_message) + RAG_TOOL_RESERVE);
     std::string context = embed_llama->rag_retrieve(*rag_db, user_message, cfg.rag_top_k, *rag_session);
     if (!context.empty()) {
       log_write("RAG: %s", context.c_str());
@@ -2271,6 +2459,10 @@ bool AgentState::run_turn(const std::string &user_message, const NitroConfig &cf
   }
   tui.append_line("Nitro: ");
 
+  // the model samples and decodes on a worker thread, leaving this thread to draw and
+  // check for escape while the next token is computed
+  llama->start(*iter);
+
   // in_think starts false — models that don't use <think> blocks emit
   // visible text immediately.  The spinner activates only while thinking.
   enum {t_init, t_think, t_thunk} think_mode = (cfg.thinking ? t_init : t_thunk);
@@ -2282,6 +2474,9 @@ bool AgentState::run_turn(const std::string &user_message, const NitroConfig &cf
     static constexpr std::string_view END_TOOL = "\nNITRO_END_TOOL";
     static const std::string TOOL_RESULT = "NITRO_TOOL_RESULT: ";
 
+    // the tool and the result it injects both need the model to themselves
+    llama->stop(*iter);
+
     std::string tool;
     const auto pos = buffer.rfind(END_TOOL);
     if (pos != std::string::npos) {
@@ -2297,11 +2492,12 @@ bool AgentState::run_turn(const std::string &user_message, const NitroConfig &cf
     log_write("tool request: mode:[%d] [%s]", think_mode, tool.c_str());
     std::string result = process_tool(tool, cfg, tui);
     if (result.empty()) {
+      llama->start(*iter);
       return;
     }
     std::string content = TOOL_RESULT + std::vformat(template_str, std::make_format_args(result)) + memory_info_status();
     log_write("tool: [%s] result: [%s]", tool.c_str(), result.c_str());
-    if (content.size() > llama->max_tool_result_size()) {
+    if (llama->count_tokens(content) > llama->max_tool_result_size()) {
       // Index the content into RAG and tell the model where to find it
       if (embed_llama && rag_db && rag_session) {
         content = std::format("Tool result too large ({} bytes). The content has been indexed. "
@@ -2318,6 +2514,8 @@ bool AgentState::run_turn(const std::string &user_message, const NitroConfig &cf
     }
     if (!iter->_has_next) {
       tui.append_line(ICON_ERR + "failed to evoke tool response: " + llama->last_error());
+    } else {
+      llama->start(*iter);
     }
     if (llama->is_memory_flush()) {
       tui.append_line(ICON_ERR + "Warning! - memory has been flushed!");
@@ -2358,9 +2556,17 @@ bool AgentState::run_turn(const std::string &user_message, const NitroConfig &cf
     return ni.id == NCKEY_ESC;
   };
 
+  auto next_piece = [&]() -> std::string {
+    std::string piece;
+    while (!llama->try_next(*iter, piece) && llama->has_next(*iter)) {
+      std::this_thread::sleep_for(TOKEN_POLL);
+    }
+    return piece;
+  };
+
   auto fetch_tool = [&]() -> void {
-    while (iter->_has_next && !is_escape()) {
-      std::string tok = llama->next(*iter);
+    while (llama->has_next(*iter) && !is_escape()) {
+      std::string tok = next_piece();
       buffer += tok;
       tui.tick_spinner();
       auto pos = buffer.find("</think>");
@@ -2370,13 +2576,13 @@ bool AgentState::run_turn(const std::string &user_message, const NitroConfig &cf
     }
   };
 
-  while (iter->_has_next && !is_escape()) {
-    std::string tok = llama->next(*iter);
+  while (llama->has_next(*iter) && !is_escape()) {
+    std::string tok = next_piece();
     if (tok == "<") {
       // fetch the complete tag
       std::string tag = tok;
-      while (iter->_has_next && tag.find(">") == std::string::npos) {
-        tag += llama->next(*iter);
+      while (llama->has_next(*iter) && tag.find(">") == std::string::npos) {
+        tag += next_piece();
       }
       if (tag == "<|think|>") {
         think_mode = t_think;
@@ -2441,6 +2647,9 @@ bool AgentState::run_turn(const std::string &user_message, const NitroConfig &cf
     }
   }
 
+  // finished, or cancelled by escape
+  llama->stop(*iter);
+
   if (!buffer.empty()) {
     tui.append_token(buffer + "\n");
   }
@@ -2453,7 +2662,7 @@ bool AgentState::run_turn(const std::string &user_message, const NitroConfig &cf
   auto patterm = ICON_SYS + "%.1f tok/s  (%d tokens)  KV %.1f%%";
   std::snprintf(stat, sizeof(stat), patterm.c_str(),
                 (double)tui.tokens_per_sec,
-                iter->_tokens_generated,
+                iter->_tokens_generated.load(),
                 (double)tui.kv_percent);
   tui.append_line(stat);
   tui.redraw_all();
@@ -2518,7 +2727,7 @@ static void handle_slash(const std::string &input,
       }
     }
     cfg.embed_path = rest;
-    if (agent.setup_embed(rest, tui)) {
+    if (agent.setup_embed(rest, cfg, tui)) {
       save_settings(cfg);
     }
     return;
@@ -2536,7 +2745,7 @@ static void handle_slash(const std::string &input,
         return;
       }
     }
-    if (path.find_last_not_of(".bin") != std::string::npos) {
+    if (path.ends_with(".bin")) {
       tui.append_line(ICON_SYS + "Loading index: " + path);
       tui.redraw_all();
       agent.rag_load_index(path, tui);
@@ -2572,6 +2781,7 @@ static void handle_slash(const std::string &input,
     tui.append_line(ICON_SYS + "Current settings:");
     tui.append_line(ICON_SYS + "  model_path    : " + cfg.model_path);
     tui.append_line(ICON_SYS + "  embed_path    : " + cfg.embed_path);
+    tui.append_line(ICON_SYS + "  draft_path    : " + cfg.draft_path);
     tui.append_line(ICON_SYS + "  sandbox       : " + cfg.sandbox);
     tui.append_line(ICON_SYS + "  n_ctx         : " + std::to_string(cfg.n_ctx));
     tui.append_line(ICON_SYS + "  n_gpu_layers  : " + std::to_string(cfg.n_gpu_layers));
@@ -2580,6 +2790,11 @@ static void handle_slash(const std::string &input,
     tui.append_line(ICON_SYS + "  top_k         : " + std::to_string(cfg.top_k));
     tui.append_line(ICON_SYS + "  penalty_repeat: " + std::to_string(cfg.penalty_repeat));
     tui.append_line(ICON_SYS + "  rag_top_k     : " + std::to_string(cfg.rag_top_k));
+    tui.append_line(ICON_SYS + "  rag_quant     : " + cfg.rag_quant);
+    tui.append_line(ICON_SYS + "  rag_rank      : " + cfg.rag_rank);
+    tui.append_line(ICON_SYS + "  rag_cache     : " + std::to_string(cfg.rag_cache) +
+                    (cfg.rag_cache_persist ? " (persisted)" : ""));
+    tui.append_line(ICON_SYS + "  rag_probe     : " + (cfg.rag_probe > 0 ? std::to_string(cfg.rag_probe) : "exact"));
     tui.append_line(ICON_SYS + "  saved to      : " + settings_path());
     tui.redraw_all();
     return;
@@ -2609,6 +2824,31 @@ static void handle_slash(const std::string &input,
       else if (key == "penalty_repeat") { cfg.penalty_repeat = std::stof(val); needs_reparam = true; }
       else if (key == "penalty_last_n") { cfg.penalty_last_n = std::stoi(val); needs_reparam = true; }
       else if (key == "rag_top_k")      { cfg.rag_top_k      = std::stoi(val); }
+      else if (key == "rag_quant")      {
+        if (val == "none" || val == "int8" || val == "binary") {
+          cfg.rag_quant = val;
+          tui.append_line(ICON_SYS + "rag_quant applies the next time an index is saved.");
+        } else {
+          tui.append_line(ICON_ERR + "rag_quant must be none, int8 or binary");
+          ok = false;
+        }
+      }
+      else if (key == "rag_cache")      {
+        cfg.rag_cache = std::max(std::stoi(val), 0);
+        if (agent.rag_session) {
+          agent.rag_session->queries.resize(cfg.rag_cache);
+        }
+      }
+      else if (key == "rag_cache_persist") { cfg.rag_cache_persist = std::stoi(val) != 0; }
+      else if (key == "rag_probe")      { cfg.rag_probe      = std::max(std::stoi(val), 0); }
+      else if (key == "rag_rank")       {
+        if (val == "fused" || val == "vector") {
+          cfg.rag_rank = val;
+        } else {
+          tui.append_line(ICON_ERR + "rag_rank must be fused or vector");
+          ok = false;
+        }
+      }
       else if (key == "n_gpu_layers")   {
         cfg.n_gpu_layers = std::stoi(val);
         tui.append_line(ICON_SYS + "n_gpu_layers will take effect on next /model load.");
@@ -2708,6 +2948,8 @@ int main(int argc, char **argv) {
       cfg.model_path = resolve_path(take_next(a.c_str()));
     } else if (a == "-e" || a == "--embed") {
       cfg.embed_path = resolve_path(take_next(a.c_str()));
+    } else if (a == "-d" || a == "--draft") {
+      cfg.draft_path = resolve_path(take_next(a.c_str()));
     } else if (a == "-g" || a == "--gpu-layers") {
       cfg.n_gpu_layers = std::stoi(take_next(a.c_str()));
     } else if (a == "-l" || a == "--log") {
@@ -2722,6 +2964,7 @@ int main(int argc, char **argv) {
                 "Options:\n"
                 "  -m, --model  <path>      GGUF model to load on startup\n"
                 "  -e, --embed  <path>      embedding model for RAG\n"
+                "  -d, --draft  <path>      draft model for speculative decoding\n"
                 "  -g, --gpu-layers <n>     GPU layers to offload (default: 32)\n"
                 "  -l, --log                enabled logging\n"
                 "  -h, --help               show this help\n"
@@ -2788,7 +3031,7 @@ int main(int argc, char **argv) {
       tui.redraw_all();
     }
     if (!cfg.embed_path.empty()) {
-      agent.setup_embed(cfg.embed_path, tui);
+      agent.setup_embed(cfg.embed_path, cfg, tui);
     }
   } else {
     tui.append_line(ICON_SYS + "No model specified.  Use /model to open the file picker,");
@@ -2827,6 +3070,7 @@ int main(int argc, char **argv) {
   }
 
   log_write("nitro exiting");
+  agent.save_query_cache(cfg);
   log_close();
   tui.destroy();
   // Persist input history for the next session.
@@ -0,0 +1,224 @@
+// This file is part of SmallBASIC
+//
+// Micro-benchmark for the rag_retrieve scoring path
+//
+//   rag_bench [n_chunks] [embed_dim] [top_k] [iterations]
+//
+// Compares the scalar and SIMD dot-product kernels over a contiguous embedding
+// matrix, a full sort against partial top-k selection, the int8 and binary
+// quantized scans with the recall of their rescored top-k, and the recall and
+// latency of the IVF index as more lists are probed.
+//
+// This program is distributed under the terms of the GPL v2.0 or later
+// Download the GNU Public License (GPL) from www.gnu.org
+//
+// Copyright(C) 2026 Chris Warren-Smith
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "llama-sb-ivf.h"
+#include "llama-sb-simd.h"
+
+using Clock = std::chrono::steady_clock;
+
+// candidates rescored per wanted result, as in rag_score
+static constexpr int RESCORE_INT8 = 4;
+static constexpr int RESCORE_BINARY = 16;
+static constexpr int RESCORE_MIN = 64;
+
+static constexpr int N_TOPICS = 4096;
+static constexpr int N_QUERIES = 50;
+
+static void normalize(float *v, int dim) {
+  float norm = 0.0f;
+  for (int i = 0; i < dim; i++) {
+    norm += v[i] * v[i];
+  }
+  norm = std::sqrt(norm);
+  for (int i = 0; i < dim; i++) {
+    v[i] /= norm;
+  }
+}
+
+//
+// fraction of the exact top_k found after rescoring the approximate candidates
+//
+static double recall(const std::vector<float> &approx, const std::vector<float> &exact,
+                     const std::vector<int> &expected, int top_k, int factor) {
+  std::vector<int> candidates;
+  simd_top_k(approx.data(), approx.size(), std::max(top_k * factor, RESCORE_MIN), candidates);
+  std::sort(candidates.begin(), candidates.end(), [&](int a, int b) { return exact[a] > exact[b]; });
+  candidates.resize(std::min((int)candidates.size(), top_k));
+  int found = 0;
+  for (int idx : candidates) {
+    found += std::count(expected.begin(), expected.end(), idx) ? 1 : 0;
+  }
+  return (double)found / expected.size();
+}
+
+template<typename F>
+static double time_ms(int iterations, F fn) {
+  auto start = Clock::now();
+  for (int i = 0; i < iterations; i++) {
+    fn();
+  }
+  std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+int main(int argc, char **argv) {
+  size_t n_chunks = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+  int dim = argc > 2 ? atoi(argv[2]) : 1024;
+  int top_k = argc > 3 ? atoi(argv[3]) : 5;
+  int iterations = argc > 4 ? atoi(argv[4]) : 20;
+
+  std::mt19937 rng(42);
+  std::normal_distribution<float> dist;
+
+  // rows are noisy copies of a few thousand topics, as real embeddings cluster,
+  // so that the quantized recall measures ranking rather than random ties
+  std::vector<float> topics(N_TOPICS * dim);
+  std::vector<float> matrix(n_chunks * dim);
+  std::vector<float> query(dim);
+  for (float &v : topics) {
+    v = dist(rng);
+  }
+  for (size_t i = 0; i < n_chunks; i++) {
+    const float *topic = topics.data() + (rng() % N_TOPICS) * dim;
+    for (int j = 0; j < dim; j++) {
+      matrix[i * dim + j] = topic[j] + dist(rng);
+    }
+  }
+  for (int j = 0; j < dim; j++) {
+    query[j] = topics[j] + dist(rng);
+  }
+  for (size_t i = 0; i < n_chunks; i++) {
+    normalize(matrix.data() + i * dim, dim);
+  }
+  normalize(query.data(), dim);
+
+  std::vector<float> scores(n_chunks);
+  std::vector<float> expected(n_chunks);
+
+  printf("chunks %zu  dim %d  top_k %d  kernel %s\n", n_chunks, dim, top_k, simd_name());
+
+  double scalar_ms = time_ms(iterations, [&]() {
+    for (size_t i = 0; i < n_chunks; i++) {
+      expected[i] = simd_dot_scalar(matrix.data() + i * dim, query.data(), dim);
+    }
+  });
+  double simd_ms = time_ms(iterations, [&]() {
+    simd_dot_rows(matrix.data(), n_chunks, dim, query.data(), scores.data());
+  });
+
+  float max_error = 0.0f;
+  for (size_t i = 0; i < n_chunks; i++) {
+    max_error = std::max(max_error, std::fabs(scores[i] - expected[i]));
+  }
+
+  std::vector<int> order(n_chunks);
+  double sort_ms = time_ms(iterations, [&]() {
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return scores[a] > scores[b]; });
+  });
+
+  std::vector<int> top;
+  double select_ms = time_ms(iterations, [&]() {
+    simd_top_k(scores.data(), n_chunks, top_k, top);
+  });
+
+  bool same = true;
+  for (int i = 0; i < top_k && i < (int)n_chunks; i++) {
+    same &= scores[top[i]] == scores[order[i]];
+  }
+
+  printf("score  scalar %8.3f ms   %-6s %8.3f ms   x%.1f   max error %g\n",
+         scalar_ms, simd_name(), simd_ms, scalar_ms / simd_ms, max_error);
+  printf("rank   sort   %8.3f ms   top_k  %8.3f ms   x%.1f   %s\n",
+         sort_ms, select_ms, sort_ms / select_ms, same ? "same order" : "ORDER DIFFERS");
+
+  // quantized scans
+  int n_words = (dim + 63) / 64;
+  std::vector<int8_t> rows_i8(n_chunks * dim);
+  std::vector<float> scales(n_chunks);
+  std::vector<uint64_t> rows_bits(n_chunks * n_words);
+  for (size_t i = 0; i < n_chunks; i++) {
+    scales[i] = simd_quantize_i8(matrix.data() + i * dim, dim, rows_i8.data() + i * dim);
+    simd_quantize_bits(matrix.data() + i * dim, dim, rows_bits.data() + i * n_words);
+  }
+  std::vector<int8_t> query_i8(dim);
+  float query_scale = simd_quantize_i8(query.data(), dim, query_i8.data());
+  std::vector<uint64_t> query_bits(n_words);
+  simd_quantize_bits(query.data(), dim, query_bits.data());
+
+  std::vector<float> approx(n_chunks);
+  double i8_ms = time_ms(iterations, [&]() {
+    simd_dot_rows_i8(rows_i8.data(), scales.data(), n_chunks, dim, query_i8.data(), query_scale, approx.data());
+  });
+  double i8_recall = recall(approx, scores, top, top_k, RESCORE_INT8);
+
+  double bits_ms = time_ms(iterations, [&]() {
+    simd_hamming_rows(rows_bits.data(), n_chunks, dim, query_bits.data(), approx.data());
+  });
+  double bits_recall = recall(approx, scores, top, top_k, RESCORE_BINARY);
+
+  printf("quant  float  %8.3f ms   %5zu bytes/chunk\n", simd_ms, dim * sizeof(float));
+  printf("       int8   %8.3f ms   %5zu bytes/chunk   recall@%d %.2f\n",
+         i8_ms, dim + sizeof(float), top_k, i8_recall);
+  printf("       binary %8.3f ms   %5zu bytes/chunk   recall@%d %.2f\n",
+         bits_ms, n_words * sizeof(uint64_t), top_k, bits_recall);
+
+  // IVF recall and latency over queries drawn from random topics
+  int n_lists = ivf_lists(n_chunks);
+  std::vector<uint32_t> ivf_data(ivf_size(n_lists, n_chunks, dim) / sizeof(uint32_t));
+  auto build_start = Clock::now();
+  ivf_build(matrix.data(), n_chunks, dim, n_lists, ivf_data.data());
+  std::chrono::duration<double, std::milli> build_ms = Clock::now() - build_start;
+  IvfIndex index = ivf_view(ivf_data.data(), n_lists, ivf_probe(n_lists), dim);
+
+  std::vector<float> queries(N_QUERIES * dim);
+  std::vector<std::vector<int>> exact(N_QUERIES);
+  for (int q = 0; q < N_QUERIES; q++) {
+    float *qv = queries.data() + q * dim;
+    const float *topic = topics.data() + (rng() % N_TOPICS) * dim;
+    for (int j = 0; j < dim; j++) {
+      qv[j] = topic[j] + dist(rng);
+    }
+    normalize(qv, dim);
+    simd_dot_rows(matrix.data(), n_chunks, dim, qv, scores.data());
+    simd_top_k(scores.data(), n_chunks, top_k, exact[q]);
+  }
+
+  printf("ivf    lists %d  default probe %d  build %.0f ms\n", n_lists, index.n_probe, build_ms.count());
+  const std::vector<bool> skip;
+  std::vector<int> probes;
+  for (int n_probe = 1; n_probe <= n_lists; n_probe *= 2) {
+    probes.push_back(n_probe);
+  }
+  probes.push_back(index.n_probe);
+  std::sort(probes.begin(), probes.end());
+  probes.erase(std::unique(probes.begin(), probes.end()), probes.end());
+  for (int n_probe : probes) {
+    std::vector<int> rows;
+    std::vector<float> row_scores;
+    int found = 0;
+    double probe_ms = time_ms(1, [&]() {
+      for (int q = 0; q < N_QUERIES; q++) {
+        ivf_search(index, matrix.data(), queries.data() + q * dim, top_k, n_probe, skip, rows, row_scores);
+        for (int idx : rows) {
+          found += std::count(exact[q].begin(), exact[q].end(), idx) ? 1 : 0;
+        }
+      }
+    }) / N_QUERIES;
+    printf("       probe %-4d %8.3f ms   x%-6.1f recall@%d %.2f\n",
+           n_probe, probe_ms, simd_ms / probe_ms, top_k, (double)found / (N_QUERIES * top_k));
+  }
+  return same ? 0 : 1;
+}
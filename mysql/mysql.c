@@ -181,13 +181,7 @@ void mq_build_result_array(MYSQL * mysql, MYSQL_RES * result, var_t * retval) {
 
       e = (var_t *) (retval->v.a.data + (sizeof(var_t) * (crow * num_fields + i)));
       if (row[i]) {
-        char *buf;
-
-        buf = (char *)malloc(lengths[i] + 1);
-        strncpy(buf, row[i], lengths[i]);
-        buf[lengths[i]] = '\0';
-        v_setstr(e, buf);
-        free(buf);
+        v_setstrn(e, row[i], lengths[i]);
       }
       else {
         v_setstr(e, "");
@@ -28,31 +28,15 @@
 #include <cstring>
 #include <cstdint>
 
-#include "robin-hood-hashing/src/include/robin_hood.h"
 #include "include/var.h"
 #include "include/module.h"
 #include "include/param.h"
+#include "include/handle.h"
 #include "physac.h"
 
 #define MAX_INPUTBOX_LENGTH 1024
 #define MAX_FILEPATH_LENGTH 4096
 
-robin_hood::unordered_map<int, AudioStream> _audioStream;
-robin_hood::unordered_map<int, Font> _fontMap;
-robin_hood::unordered_map<int, Image> _imageMap;
-robin_hood::unordered_map<int, Matrix> _matrixMap;
-robin_hood::unordered_map<int, Mesh> _meshMap;
-robin_hood::unordered_map<int, Model> _modelMap;
-robin_hood::unordered_map<int, ModelAnimation> _modelAnimationMap;
-robin_hood::unordered_map<int, Music> _musicMap;
-robin_hood::unordered_map<int, PhysicsBody> _physicsMap;
-robin_hood::unordered_map<int, RenderTexture2D> _renderMap;
-robin_hood::unordered_map<int, Sound> _soundMap;
-robin_hood::unordered_map<int, Texture2D> _textureMap;
-robin_hood::unordered_map<int, Wave> _waveMap;
-robin_hood::unordered_map<int, AutomationEventList> _automationEventListMap;
-int _nextId = 1;
-
 #define CLS_AUDIOSTREAM 1
 #define CLS_FONTMAP 2
 #define CLS_IMAGEMAP 3
@@ -68,10 +52,93 @@ int _nextId = 1;
 #define CLS_WAVEMAP 14
 #define CLS_AUTOMATIONEVENTLISTMAP 15
 
+//
+// render texture along with the handle of its texture field in _textureMap
+//
+struct RenderTarget : public RenderTexture2D {
+  RenderTarget() : RenderTexture2D(), _textureId(-1) {}
+  RenderTarget(const RenderTexture2D &target, int textureId) : RenderTexture2D(target), _textureId(textureId) {}
+  int _textureId;
+};
+
+static void release_audio_stream(AudioStream &audioStream) {
+  StopAudioStream(audioStream);
+  UnloadAudioStream(audioStream);
+}
+
+static void release_font(Font &font) {
+  UnloadFont(font);
+}
+
+static void release_image(Image &image) {
+  UnloadImage(image);
+}
+
+static void release_model(Model &model) {
+  UnloadModel(model);
+}
+
+static void release_model_animation(ModelAnimation &animation) {
+  UnloadModelAnimations(&animation, 1);
+}
+
+static void release_music(Music &music) {
+  StopMusicStream(music);
+  UnloadMusicStream(music);
+}
+
+static void release_sound(Sound &sound) {
+  StopSound(sound);
+  UnloadSound(sound);
+}
+
+static void release_texture(Texture2D &texture) {
+  UnloadTexture(texture);
+}
+
+static void release_wave(Wave &wave) {
+  UnloadWave(wave);
+}
+
+static void release_render_target(RenderTarget &target);
+
+HandleTable<AudioStream> _audioStream(CLS_AUDIOSTREAM, release_audio_stream);
+HandleTable<Font> _fontMap(CLS_FONTMAP, release_font);
+HandleTable<Image> _imageMap(CLS_IMAGEMAP, release_image);
+HandleTable<Matrix> _matrixMap(CLS_MATRIXMAP);
+// UnloadMesh causes a seg-fault, the mesh is owned by its model
+HandleTable<Mesh> _meshMap(CLS_MESHMAP);
+HandleTable<Model> _modelMap(CLS_MODELMAP, release_model);
+HandleTable<ModelAnimation> _modelAnimationMap(CLS_MODELANIMATIONMAP, release_model_animation);
+HandleTable<Music> _musicMap(CLS_MUSICMAP, release_music);
+HandleTable<PhysicsBody> _physicsMap(CLS_PHYSICSMAP);
+HandleTable<RenderTarget> _renderMap(CLS_RENDERMAP, release_render_target);
+HandleTable<Sound> _soundMap(CLS_SOUNDMAP, release_sound);
+HandleTable<Texture2D> _textureMap(CLS_TEXTUREMAP, release_texture);
+HandleTable<Wave> _waveMap(CLS_WAVEMAP, release_wave);
+HandleTable<AutomationEventList> _automationEventListMap(CLS_AUTOMATIONEVENTLISTMAP);
+
+static void release_render_target(RenderTarget &target) {
+  UnloadRenderTexture(target);
+  // the texture field is unloaded by UnloadRenderTexture
+  _textureMap.erase(target._textureId);
+}
+
+static const MapKey KEY_X = map_key("x");
+static const MapKey KEY_Y = map_key("y");
+static const MapKey KEY_Z = map_key("z");
+static const MapKey KEY_W = map_key("w");
+static const MapKey KEY_R = map_key("r");
+static const MapKey KEY_G = map_key("g");
+static const MapKey KEY_B = map_key("b");
+static const MapKey KEY_A = map_key("a");
+static const MapKey KEY_WIDTH = map_key("width");
+static const MapKey KEY_HEIGHT = map_key("height");
+
 PhysicsBody get_physics_body(var_p_t var) {
   PhysicsBody result;
   int id = var->v.fn.id;
-  if (id != -1 && _physicsMap.find(id) != _physicsMap.end()) {
+  if (id != -1 && _physicsMap.contains(id)) {
     result = _physicsMap.at(id);
   } else {
     result = nullptr;
@@ -101,9 +168,9 @@ static Vector3 get_map_vec3(var_p_t map, const char *name) {
     result.y = get_array_elem_num(array, 1);
     result.z = get_array_elem_num(array, 2);
   } else if (is_map(array)) {
-    result.x = get_map_num(array, "x");
-    result.y = get_map_num(array, "y");
-    result.z = get_map_num(array, "z");
+    result.x = get_map_num_h(array, KEY_X);
+    result.y = get_map_num_h(array, KEY_Y);
+    result.z = get_map_num_h(array, KEY_Z);
   } else {
     TraceLog(LOG_FATAL, "Vector3 not found");
   }
@@ -129,10 +196,10 @@ static Color get_param_color(int argc, slib_par_t *params, int n) {
       result.a = 255;
     }
   } if (is_param_map(argc, params, n)) {
-    result.r = get_map_num(params[n].var_p, "r");
-    result.g = get_map_num(params[n].var_p, "g");
-    result.b = get_map_num(params[n].var_p, "b");
-    result.a = get_map_num(params[n].var_p, "a");
+    result.r = get_map_num_h(params[n].var_p, KEY_R);
+    result.g = get_map_num_h(params[n].var_p, KEY_G);
+    result.b = get_map_num_h(params[n].var_p, KEY_B);
+    result.a = get_map_num_h(params[n].var_p, KEY_A);
   }
   return result;
 }
@@ -140,10 +207,10 @@ static Color get_param_color(int argc, slib_par_t *params, int n) {
 static Rectangle get_param_rect(int argc, slib_par_t *params, int n) {
   Rectangle result;
   if (is_param_map(argc, params, n)) {
-    result.x = get_map_num(params[n].var_p, "x");
-    result.y = get_map_num(params[n].var_p, "y");
-    result.width = get_map_num(params[n].var_p, "width");
-    result.height = get_map_num(params[n].var_p, "height");
+    result.x = get_map_num_h(params[n].var_p, KEY_X);
+    result.y = get_map_num_h(params[n].var_p, KEY_Y);
+    result.width = get_map_num_h(params[n].var_p, KEY_WIDTH);
+    result.height = get_map_num_h(params[n].var_p, KEY_HEIGHT);
   } else if (is_param_array(argc, params, n)) {
     result.x = get_array_elem_num(params[n].var_p, 0);
     result.y = get_array_elem_num(params[n].var_p, 1);
@@ -158,10 +225,10 @@ static NPatchInfo get_param_npatch(int argc, slib_par_t *params, int n) {
   if (is_param_map(argc, params, n) && is_map(map_get(params[n].var_p, "source"))) {
     var_p_t map = params[n].var_p;
     var_p_t source = map_get(map, "source");
-    result.source.x = get_map_num(source, "x");
-    result.source.y = get_map_num(source, "y");
-    result.source.width = get_map_num(source, "width");
-    result.source.height = get_map_num(source, "height");
+    result.source.x = get_map_num_h(source, KEY_X);
+    result.source.y = get_map_num_h(source, KEY_Y);
+    result.source.width = get_map_num_h(source, KEY_WIDTH);
+    result.source.height = get_map_num_h(source, KEY_HEIGHT);
     result.left = get_map_num(map, "left");
     result.top = get_map_num(map, "top");
     result.right = get_map_num(map, "right");
@@ -194,8 +261,8 @@ static Vector2 get_map_vec2(var_p_t map, const char *name) {
     result.y = get_array_elem_num(array, 1);
   } else if (is_map(array)) {
     var_p_t var = map_get(map, name);
-    result.x = get_map_num(var, "x");
-    result.y = get_map_num(var, "y");
+    result.x = get_map_num_h(var, KEY_X);
+    result.y = get_map_num_h(var, KEY_Y);
   } else {
     TraceLog(LOG_FATAL, "Vector2 not found");
   }
@@ -257,8 +324,8 @@ static Vector3 *get_param_vec3_array(int argc, slib_par_t *params, int n) {
 static Vector2 get_param_vec2(int argc, slib_par_t *params, int n) {
   Vector2 result;
   if (is_param_map(argc, params, n)) {
-    result.x = get_map_num(params[n].var_p, "x");
-    result.y = get_map_num(params[n].var_p, "y");
+    result.x = get_map_num_h(params[n].var_p, KEY_X);
+    result.y = get_map_num_h(params[n].var_p, KEY_Y);
   } else if (is_param_array(argc, params, n)) {
     result.x = get_array_elem_num(params[n].var_p, 0);
     result.y = get_array_elem_num(params[n].var_p, 1);
@@ -272,9 +339,9 @@ static Vector2 get_param_vec2(int argc, slib_par_t *params, int n) {
 static Vector3 get_param_vec3(int argc, slib_par_t *params, int n) {
   Vector3 result;
   if (is_param_map(argc, params, n)) {
-    result.x = get_map_num(params[n].var_p, "x");
-    result.y = get_map_num(params[n].var_p, "y");
-    result.z = get_map_num(params[n].var_p, "z");
+    result.x = get_map_num_h(params[n].var_p, KEY_X);
+    result.y = get_map_num_h(params[n].var_p, KEY_Y);
+    result.z = get_map_num_h(params[n].var_p, KEY_Z);
   } else if (is_param_array(argc, params, n)) {
     result.x = get_array_elem_num(params[n].var_p, 0);
     result.y = get_array_elem_num(params[n].var_p, 1);
@@ -290,10 +357,10 @@ static Vector3 get_param_vec3(int argc, slib_par_t *params, int n) {
 static Vector4 get_param_vec4(int argc, slib_par_t *params, int n) {
   Vector4 result;
   if (is_param_map(argc, params, n)) {
-    result.x = get_map_num(params[n].var_p, "x");
-    result.y = get_map_num(params[n].var_p, "y");
-    result.z = get_map_num(params[n].var_p, "z");
-    result.w = get_map_num(params[n].var_p, "w");
+    result.x = get_map_num_h(params[n].var_p, KEY_X);
+    result.y = get_map_num_h(params[n].var_p, KEY_Y);
+    result.z = get_map_num_h(params[n].var_p, KEY_Z);
+    result.w = get_map_num_h(params[n].var_p, KEY_W);
   } else if (is_param_array(argc, params, n)) {
     result.x = get_array_elem_num(params[n].var_p, 0);
     result.y = get_array_elem_num(params[n].var_p, 1);
@@ -441,7 +508,7 @@ static int get_audiostream_id(int argc, slib_par_t *params, int arg, var_t *retv
   int result = -1;
   if (is_param_map(argc, params, arg)) {
     int id = get_id(params, arg);
-    if (id != -1 && _audioStream.find(id) != _audioStream.end()) {
+    if (id != -1 && _audioStream.contains(id)) {
       result = id;
     }
   }
@@ -456,7 +523,7 @@ static int get_font_id(int argc, slib_par_t *params, int arg, var_t *retval) {
   if (is_param_map(argc, params, arg)) {
     // the passed in variable is a map
     int id = get_id(params, arg);
-    if (id != -1 && _fontMap.find(id) != _fontMap.end()) {
+    if (id != -1 && _fontMap.contains(id)) {
       // the map contained an ID field with a live value
       result = id;
     }
@@ -471,7 +538,7 @@ static int get_image_id(int argc, slib_par_t *params, int arg, var_t *retval) {
   int result = -1;
   if (is_param_map(argc, params, arg)) {
     int id = get_id(params, arg);
-    if (id != -1 && _imageMap.find(id) != _imageMap.end()) {
+    if (id != -1 && _imageMap.contains(id)) {
       result = id;
     }
   }
@@ -485,7 +552,7 @@ static int get_mesh_id(int argc, slib_par_t *params, int arg, var_t *retval) {
   int result = -1;
   if (is_param_map(argc, params, arg)) {
     int id = get_id(params, arg);
-    if (id != -1 && _meshMap.find(id) != _meshMap.end()) {
+    if (id != -1 && _meshMap.contains(id)) {
       result = id;
     }
   }
@@ -499,7 +566,7 @@ static int get_texture_id(int argc, slib_par_t *params, int arg, var_t *retval)
   int result = -1;
   if (is_param_map(argc, params, arg)) {
     int id = get_id(params, arg);
-    if (id != -1 && _textureMap.find(id) != _textureMap.end()) {
+    if (id != -1 && _textureMap.contains(id)) {
       result = id;
     }
   }
@@ -513,7 +580,7 @@ static int get_model_id(int argc, slib_par_t *params, int arg, var_t *retval) {
   int result = -1;
   if (is_param_map(argc, params, arg)) {
     int id = get_id(params, arg);
-    if (id != -1 && _modelMap.find(id) != _modelMap.end()) {
+    if (id != -1 && _modelMap.contains(id)) {
       result = id;
     }
   }
@@ -527,7 +594,7 @@ static int get_model_animation_id(int argc, slib_par_t *params, int arg, var_t *
   int result = -1;
   if (is_param_map(argc, params, arg)) {
     int id = get_id(params, arg);
-    if (id != -1 && _modelAnimationMap.find(id) != _modelAnimationMap.end()) {
+    if (id != -1 && _modelAnimationMap.contains(id)) {
       result = id;
     }
   }
@@ -541,7 +608,7 @@ static int get_physics_body_id(int argc, slib_par_t *params, int arg, var_t *ret
   int result = -1;
   if (is_param_map(argc, params, arg)) {
     int id = get_id(params, arg);
-    if (id != -1 && _physicsMap.find(id) != _physicsMap.end()) {
+    if (id != -1 && _physicsMap.contains(id)) {
       result = id;
     }
   }
@@ -555,7 +622,7 @@ static int get_render_texture_id(int argc, slib_par_t *params, int arg, var_t *r
   int result = -1;
   if (is_param_map(argc, params, arg)) {
     int id = get_id(params, arg);
-    if (id != -1 && _renderMap.find(id) != _renderMap.end()) {
+    if (id != -1 && _renderMap.contains(id)) {
       result = id;
     }
   }
@@ -569,7 +636,7 @@ static int get_matrix_id(int argc, slib_par_t *params, int arg, var_t *retval) {
   int result = -1;
   if (is_param_map(argc, params, arg)) {
     int id = get_id(params, arg);
-    if (id != -1 && _matrixMap.find(id) != _matrixMap.end()) {
+    if (id != -1 && _matrixMap.contains(id)) {
       result = id;
     }
   }
@@ -583,7 +650,7 @@ static int get_music_id(int argc, slib_par_t *params, int arg, var_t *retval) {
   int result = -1;
   if (is_param_map(argc, params, arg)) {
     int id = get_id(params, arg);
-    if (id != -1 && _musicMap.find(id) != _musicMap.end()) {
+    if (id != -1 && _musicMap.contains(id)) {
       _musicMap.at(id).looping = map_get_int(params[arg].var_p, "looping", 0);
       result = id;
     }
@@ -598,7 +665,7 @@ static int get_wave_id(int argc, slib_par_t *params, int arg, var_t *retval) {
   int result = -1;
   if (is_param_map(argc, params, arg)) {
     int id = get_id(params, arg);
-    if (id != -1 && _waveMap.find(id) != _waveMap.end()) {
+    if (id != -1 && _waveMap.contains(id)) {
       result = id;
     }
   }
@@ -612,7 +679,7 @@ static int get_sound_id(int argc, slib_par_t *params, int arg, var_t *retval) {
   int result = -1;
   if (is_param_map(argc, params, arg)) {
     int id = get_id(params, arg);
-    if (id != -1 && _soundMap.find(id) != _soundMap.end()) {
+    if (id != -1 && _soundMap.contains(id)) {
       result = id;
     }
   }
@@ -626,7 +693,7 @@ static int get_automationeventlist_id(int argc, slib_par_t *params, int arg, var
   int result = -1;
   if (is_param_map(argc, params, arg)) {
     int id = get_id(params, arg);
-    if (id != -1 && _automationEventListMap.find(id) != _automationEventListMap.end()) {
+    if (id != -1 && _automationEventListMap.contains(id)) {
       result = id;
     }
   }
@@ -638,37 +705,37 @@ static int get_automationeventlist_id(int argc, slib_par_t *params, int arg, var
 
 static void v_setrect(var_t *var, int width, int height, int id) {
   map_init_id(var, id);
-  v_setint(map_add_var(var, "width", 0), width);
-  v_setint(map_add_var(var, "height", 0), height);
+  v_setint(map_add_var_h(var, KEY_WIDTH, 0), width);
+  v_setint(map_add_var_h(var, KEY_HEIGHT, 0), height);
 }
 
 static void v_setrect(var_t *var, Rectangle &rect) {
-  map_init(var);
-  v_setreal(map_add_var(var, "x", 0), rect.x);
-  v_setreal(map_add_var(var, "y", 0), rect.y);
-  v_setreal(map_add_var(var, "width", 0), rect.width);
-  v_setreal(map_add_var(var, "height", 0), rect.height);
+  map_init_size(var, 4);
+  v_setreal(map_add_var_h(var, KEY_X, 0), rect.x);
+  v_setreal(map_add_var_h(var, KEY_Y, 0), rect.y);
+  v_setreal(map_add_var_h(var, KEY_WIDTH, 0), rect.width);
+  v_setreal(map_add_var_h(var, KEY_HEIGHT, 0), rect.height);
 }
 
 static void v_setvec2(var_t *var, Vector2 &vec2) {
-  map_init(var);
-  v_setreal(map_add_var(var, "x", 0), vec2.x);
-  v_setreal(map_add_var(var, "y", 0), vec2.y);
+  map_init_size(var, 2);
+  v_setreal(map_add_var_h(var, KEY_X, 0), vec2.x);
+  v_setreal(map_add_var_h(var, KEY_Y, 0), vec2.y);
 }
 
 static void v_setvec3(var_t *var, Vector3 &vec3) {
-  map_init(var);
-  v_setreal(map_add_var(var, "x", 0), vec3.x);
-  v_setreal(map_add_var(var, "y", 0), vec3.y);
-  v_setreal(map_add_var(var, "z", 0), vec3.z);
+  map_init_size(var, 3);
+  v_setreal(map_add_var_h(var, KEY_X, 0), vec3.x);
+  v_setreal(map_add_var_h(var, KEY_Y, 0), vec3.y);
+  v_setreal(map_add_var_h(var, KEY_Z, 0), vec3.z);
 }
 
 static void v_setvec4(var_t *var, Vector4 &vec4) {
-  map_init(var);
-  v_setreal(map_add_var(var, "x", 0), vec4.x);
-  v_setreal(map_add_var(var, "y", 0), vec4.y);
-  v_setreal(map_add_var(var, "z", 0), vec4.z);
-  v_setreal(map_add_var(var, "w", 0), vec4.w);
+  map_init_size(var, 4);
+  v_setreal(map_add_var_h(var, KEY_X, 0), vec4.x);
+  v_setreal(map_add_var_h(var, KEY_Y, 0), vec4.y);
+  v_setreal(map_add_var_h(var, KEY_Z, 0), vec4.z);
+  v_setreal(map_add_var_h(var, KEY_W, 0), vec4.w);
 }
 
 static void v_setboundingbox(var_t *var, BoundingBox &box) {
@@ -683,8 +750,7 @@ static void v_setcolor(var_t *var, Color &c) {
 }
 
 static void v_setaudiostream(var_t *var, AudioStream &audioStream) {
-  int id = ++_nextId;
-  _audioStream[id] = audioStream;
+  int id = _audioStream.add(audioStream);
   map_init_id(var, id, CLS_AUDIOSTREAM);
   v_setint(map_add_var(var, "sampleRate", 0), audioStream.sampleRate);
   v_setint(map_add_var(var, "sampleSize", 0), audioStream.sampleSize);
@@ -692,8 +758,7 @@ static void v_setaudiostream(var_t *var, AudioStream &audioStream) {
 }
 
 static void v_setfont(var_t *var, Font &font) {
-  auto id = ++_nextId;
-  _fontMap[id] = font;
+  auto id = _fontMap.add(font);
   map_init_id(var, id, CLS_FONTMAP);
   v_setint(map_add_var(var, "baseSize", 0), font.baseSize);
   v_setint(map_add_var(var, "charsCount", 0), font.glyphCount);
@@ -701,8 +766,7 @@ static void v_setfont(var_t *var, Font &font) {
 
 static void v_setphysics(var_t *var, PhysicsBody &physics) {
   if (physics != NULL) {
-    auto id = ++_nextId;
-    _physicsMap[id] = physics;
+    auto id = _physicsMap.add(physics);
     create(physics, var, id);
   } else {
     v_setint(var, 0);
@@ -715,8 +779,7 @@ static void v_setshader(var_t *var, Shader &shader) {
 }
 
 static void v_settexture2d(var_t *var, Texture2D &texture) {
-  int id = ++_nextId;
-  _textureMap[id] = texture;
+  int id = _textureMap.add(texture);
   v_setrect(var, texture.width, texture.height, id);
   v_setint(map_add_var(var, "id", 0), texture.id);
   v_setint(map_add_var(var, "mipmaps", 0), texture.mipmaps);
@@ -724,28 +787,24 @@ static void v_settexture2d(var_t *var, Texture2D &texture) {
 }
 
 static void v_setimage(var_t *var, Image &image) {
-  int id = ++_nextId;
-  _imageMap[id] = image;
+  int id = _imageMap.add(image);
   v_setrect(var, image.width, image.height, id);
 }
 
 static void v_setmesh(var_t *var, Mesh &mesh) {
-  int id = ++_nextId;
-  _meshMap[id] = mesh;
+  int id = _meshMap.add(mesh);
   map_init_id(var, id, CLS_MESHMAP);
   v_setint(map_add_var(var, "vertexCount", 0), mesh.vertexCount);
   v_setint(map_add_var(var, "triangleCount", 0), mesh.triangleCount);
 }
 
 static void v_setmatrix(var_t *var, Matrix &matrix) {
-  int id = ++_nextId;
-  _matrixMap[id] = matrix;
+  int id = _matrixMap.add(matrix);
   map_init_id(var, id, CLS_MATRIXMAP);
 }
 
 static void v_setmodel(var_t *var, Model &model) {
-  auto id = ++_nextId;
-  _modelMap[id] = model;
+  auto id = _modelMap.add(model);
   map_init_id(var, id, CLS_MODELMAP);
   v_setint(map_add_var(var, "meshCount", 0), model.meshCount);
   v_setint(map_add_var(var, "materialCount", 0), model.materialCount);
@@ -753,8 +812,7 @@ static void v_setmodel(var_t *var, Model &model) {
 }
 
 static void v_setmusic(var_t *var, Music &music) {
-  int id = ++_nextId;
-  _musicMap[id] = music;
+  int id = _musicMap.add(music);
   map_init_id(var, id, CLS_MUSICMAP);
   v_setint(map_add_var(var, "frameCount", 0), music.frameCount);
   v_setint(map_add_var(var, "looping", 0), music.looping);
@@ -765,8 +823,7 @@ static void v_setmodel_animation(var_t *var, ModelAnimation *anims, int animsCou
   v_toarray1(var, animsCount);
   for (int i = 0; i < animsCount; i++) {
     var_t *v_anim = v_elem(var, i);
-    auto id = ++_nextId;
-    _modelAnimationMap[id] = anims[i];
+    auto id = _modelAnimationMap.add(anims[i]);
     map_init_id(v_anim, id, CLS_MODELANIMATIONMAP);
 
     int keyframeCount = anims[i].keyframeCount;
@@ -802,15 +859,13 @@ static void v_setray(var_t *var, Ray &ray) {
 }
 
 static void v_setsound(var_t *var, Sound &sound) {
-  int id = ++_nextId;
-  _soundMap[id] = sound;
+  int id = _soundMap.add(sound);
   map_init_id(var, id, CLS_SOUNDMAP);
   v_setint(map_add_var(var, "frameCount", 0), sound.frameCount);
 }
 
 static void v_setwave(var_t *var, Wave &wave) {
-  int id = ++_nextId;
-  _waveMap[id] = wave;
+  int id = _waveMap.add(wave);
   map_init_id(var, id, CLS_WAVEMAP);
   v_setint(map_add_var(var, "frameCount", 0), wave.frameCount);
   v_setint(map_add_var(var, "sampleRate", 0), wave.sampleRate);
@@ -846,8 +901,7 @@ static AutomationEvent get_param_automationevent(int argc, slib_par_t *params, i
 }
 
 static void v_setautomationeventlist(var_t *var, AutomationEventList &automationEventList) {
-  int id = ++_nextId;
-  _automationEventListMap[id] = automationEventList;
+  int id = _automationEventListMap.add(automationEventList);
 
   map_init_id(var, id, CLS_AUTOMATIONEVENTLISTMAP);
   v_setint(map_add_var(var, "count", 0), automationEventList.count);
@@ -984,12 +1038,10 @@ static int cmd_setmodeltransform(int argc, slib_par_t *params, var_t *retval) {
 static int cmd_loadrendertexture(int argc, slib_par_t *params, var_t *retval) {
   auto width = get_param_int(argc, params, 0, 0);
   auto height = get_param_int(argc, params, 1, 0);
-  auto renderId = ++_nextId;
   auto renderTexture = LoadRenderTexture(width, height);
-  _renderMap[renderId] = renderTexture;
+  auto textureId = _textureMap.add(renderTexture.texture);
+  auto renderId = _renderMap.add(RenderTarget(renderTexture, textureId));
   map_init_id(retval, renderId, CLS_RENDERMAP);
-  auto textureId = ++_nextId;
-  _textureMap[textureId] = renderTexture.texture;
   var_p_t texture = map_add_var(retval, "texture", 0);
   v_setrect(texture, renderTexture.texture.width, renderTexture.texture.height, textureId);
   return 1;
@@ -1770,7 +1822,7 @@ static int cmd_setphysbodyfreezeorient(int argc, slib_par_t *params, var_t *retv
   return result;
 }
 
-static FUNC_SIG lib_func[] = {
+FUNC_SIG lib_func[] = {
 #include "func-def.h"
   {1, 1, "MESHBOUNDINGBOX", cmd_meshboundingbox},
   {2, 2, "LOADSHADER", cmd_loadshader},
@@ -1813,7 +1865,7 @@ static FUNC_SIG lib_func[] = {
   {1, 1, "UPDATEAUTOMATIONEVENTLIST", cmd_updateautomationeventlist},
 };
 
-static FUNC_SIG lib_proc[] = {
+FUNC_SIG lib_proc[] = {
 #include "proc-def.h"
   {2, 2, "IMAGEKERNELCONVOLUTION", cmd_imagekernelconvolution},
   {4, 5, "SETSHADERVALUE", cmd_setshadervalue},
@@ -1875,162 +1927,8 @@ SBLIB_API int sblib_func_count() {
   return (sizeof(lib_func) / sizeof(lib_func[0]));
 }
 
-SBLIB_API int sblib_proc_getname(int index, char *proc_name) {
-  int result;
-  if (index < sblib_proc_count()) {
-    strcpy(proc_name, lib_proc[index]._name);
-    result = 1;
-  } else {
-    result = 0;
-  }
-  return result;
-}
-
-SBLIB_API int sblib_func_getname(int index, char *proc_name) {
-  int result;
-  if (index < sblib_func_count()) {
-    strcpy(proc_name, lib_func[index]._name);
-    result = 1;
-  } else {
-    result = 0;
-  }
-  return result;
-}
-
-SBLIB_API int sblib_proc_exec(int index, int argc, slib_par_t *params, var_t *retval) {
-  int result;
-  if (index >= 0 && index < sblib_proc_count()) {
-    if (argc < lib_proc[index]._min || argc > lib_proc[index]._max) {
-      if (lib_proc[index]._min == lib_proc[index]._max) {
-        error(retval, lib_proc[index]._name, lib_proc[index]._min);
-      } else {
-        error(retval, lib_proc[index]._name, lib_proc[index]._min, lib_proc[index]._max);
-      }
-      result = 0;
-    } else {
-      result = lib_proc[index]._command(argc, params, retval);
-    }
-  } else {
-    fprintf(stderr, "Raylib: PROC index error [%d]\n", index);
-    result = 0;
-  }
-  return result;
-}
-
-SBLIB_API int sblib_func_exec(int index, int argc, slib_par_t *params, var_t *retval) {
-  int result;
-  if (index >= 0 && index < sblib_func_count()) {
-    if (argc < lib_func[index]._min || argc > lib_func[index]._max) {
-      if (lib_func[index]._min == lib_func[index]._max) {
-        error(retval, lib_func[index]._name, lib_func[index]._min);
-      } else {
-        error(retval, lib_func[index]._name, lib_func[index]._min, lib_func[index]._max);
-      }
-      result = 0;
-    } else {
-      result = lib_func[index]._command(argc, params, retval);
-    }
-  } else {
-    fprintf(stderr, "Raylib: FUNC index error [%d]\n", index);
-    result = 0;
-  }
-  return result;
-}
-
 SBLIB_API int sblib_free(int cls_id, int id) {
-  if (id != -1) {
-    switch (cls_id) {
-    case CLS_AUDIOSTREAM:
-      if (_audioStream.find(id) != _audioStream.end()) {
-        StopAudioStream(_audioStream.at(id));
-        UnloadAudioStream(_audioStream.at(id));
-        _audioStream.erase(id);
-      }
-      break;
-    case CLS_FONTMAP:
-      if (_fontMap.find(id) != _fontMap.end()) {
-        UnloadFont(_fontMap.at(id));
-        _fontMap.erase(id);
-      }
-      break;
-    case CLS_IMAGEMAP:
-      if (_imageMap.find(id) != _imageMap.end()) {
-        UnloadImage(_imageMap.at(id));
-        _imageMap.erase(id);
-      }
-      break;
-    case CLS_MATRIXMAP:
-      if (_matrixMap.find(id) != _matrixMap.end()) {
-        _matrixMap.erase(id);
-      }
-      break;
-    case CLS_MESHMAP:
-      if (_meshMap.find(id) != _meshMap.end()) {
-        // causes seg-fault: UnloadMesh(_meshMap.at(id));
-        _meshMap.erase(id);
-      }
-      break;
-    case CLS_MODELMAP:
-      if (_modelMap.find(id) != _modelMap.end()) {
-        UnloadModel(_modelMap.at(id));
-        _modelMap.erase(id);
-      }
-      break;
-    case CLS_MODELANIMATIONMAP:
-      if (_modelAnimationMap.find(id) != _modelAnimationMap.end()) {
-        UnloadModelAnimations(&_modelAnimationMap.at(id), 1);
-        _modelAnimationMap.erase(id);
-      }
-      break;
-    case CLS_MUSICMAP:
-      if (_musicMap.find(id) != _musicMap.end()) {
-        StopMusicStream(_musicMap.at(id));
-        UnloadMusicStream(_musicMap.at(id));
-        _musicMap.erase(id);
-      }
-      break;
-    case CLS_PHYSICSMAP:
-      if (_physicsMap.find(id) != _physicsMap.end()) {
-        _physicsMap.erase(id);
-      }
-      break;
-    case CLS_RENDERMAP:
-      if (_renderMap.find(id) != _renderMap.end()) {
-        UnloadRenderTexture(_renderMap.at(id));
-        _renderMap.erase(id);
-      }
-      // renderTexture has a texture field which should be unloaded by UnloadRenderTexture
-      if (_textureMap.find(id + 1) != _textureMap.end()) {
-        _textureMap.erase(id + 1);
-      }
-      break;
-    case CLS_SOUNDMAP:
-      if (_soundMap.find(id) != _soundMap.end()) {
-        StopSound(_soundMap.at(id));
-        UnloadSound(_soundMap.at(id));
-        _soundMap.erase(id);
-      }
-      break;
-    case CLS_TEXTUREMAP:
-      if (_textureMap.find(id) != _textureMap.end()) {
-        UnloadTexture(_textureMap.at(id));
-        _textureMap.erase(id);
-      }
-      break;
-    case CLS_WAVEMAP:
-      if (_waveMap.find(id) != _waveMap.end()) {
-        UnloadWave(_waveMap.at(id));
-        _waveMap.erase(id);
-      }
-      break;
-    case CLS_AUTOMATIONEVENTLISTMAP:
-      if (_automationEventListMap.find(id) != _automationEventListMap.end()) {
-        _automationEventListMap.erase(id);
-      }
-      break;
-    }
-  }
-  return 0;
+  return handle_free(cls_id, id);
 }
 
 SBLIB_API void sblib_close(void) {
@@ -2092,7 +1990,7 @@ SBLIB_API void sblib_close(void) {
   }
   if (!_automationEventListMap.empty()) {
     TraceLog(LOG_ERROR, "AutomationEventList leak detected");
-    _waveMap.clear();
+    _automationEventListMap.clear();
   }
 }
 